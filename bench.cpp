@@ -0,0 +1,168 @@
+// Microbenchmarks of every stage a script goes through, plus whole representative scripts.
+//   ./bench --benchmark_filter=Scan --benchmark_out=bench.json --benchmark_out_format=json
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "compiler.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "player.h"
+#include "vm.h"
+
+namespace {
+// Text output that goes nowhere, so the benchmarks measure formatting but not the terminal.
+Output& discard() {
+    static std::unique_ptr<Output> output = Output::create(Output::Format::Text, open("/dev/null", O_WRONLY));
+    return *output;
+}
+
+// `lines` lines cycling through the statements scripts are made of.
+std::string generateScript(size_t lines) {
+    std::string script;
+    for (size_t i = 0; i < lines; i++) {
+        std::string n = std::to_string(i);
+        switch (i % 6) {
+            case 0:
+                script += "let v" + n + " = " + n + " * 2.5 + (1 - v" + n + ")\n";
+                break;
+            case 1:
+                script += "sprintjump45.wa 12 -45.0 sprintair 11 sneak.s 3\n";
+                break;
+            case 2:
+                script += "fn step" + n + "(k) { sneak k outx k }\n";
+                break;
+            case 3:
+                script += "if v" + n + " >= 10 && true { facing 12.5 } else { walk 3 }\n";
+                break;
+            case 4:
+                script += "while false { print 'loop' v" + n + " }\n";
+                break;
+            case 5:
+                script += "outz 1.0 xmm zb | facing -33.3\n";
+                break;
+        }
+    }
+    return script;
+}
+
+Script parse(const std::string& source) {
+    Scanner scanner(source);
+    Script script = scanner.scan();
+    Optimizer(*script.arena).optimize(script);
+    return script;
+}
+
+void BM_LexerNext(benchmark::State& state) {
+    std::string source = generateScript(state.range(0));
+    for (auto _ : state) {
+        Lexer lexer(source);
+        while (lexer.next().type != TokenType::EndOfFile) {
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_LexerNext)->Arg(1 << 10)->Arg(1 << 14);
+
+void BM_ScannerScan(benchmark::State& state) {
+    std::string source = generateScript(state.range(0));
+    for (auto _ : state) {
+        Scanner scanner(source);
+        Script script = scanner.scan();
+        benchmark::DoNotOptimize(script.root);
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_ScannerScan)->Arg(1 << 10)->Arg(1 << 14);
+
+void runTree(benchmark::State& state, const std::string& source) {
+    Script script = parse(source);
+    for (auto _ : state) {
+        CodeVisitor visitor(discard());
+        script.root->accept(visitor);
+    }
+}
+
+void BM_CodeVisitorLoop(benchmark::State& state) {
+    runTree(state, "let i = 0 while i < " + std::to_string(state.range(0)) + " { i = i + 1 }");
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CodeVisitorLoop)->Arg(1000)->Arg(100000);
+
+void BM_CodeVisitorCall(benchmark::State& state) {
+    runTree(state, "let total = 0 fn step(k) { total = total + k } let i = 0 while i < " +
+                       std::to_string(state.range(0)) + " { step i i = i + 1 }");
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CodeVisitorCall)->Arg(1000)->Arg(100000);
+
+// Player::move for `duration` ticks of sprinting in every state. Long moves take the repeated tick path.
+void BM_PlayerMove(benchmark::State& state) {
+    State movement = static_cast<State>(state.range(0));
+    int duration = state.range(1);
+    Player start;
+    start.keys = keyMask("w");
+    for (auto _ : state) {
+        Player player = start;
+        player.move(duration, std::nullopt, 0.0f, std::nullopt, true, false, std::nullopt, std::nullopt, movement);
+        benchmark::DoNotOptimize(player.position);
+    }
+    state.SetItemsProcessed(state.iterations() * duration);
+}
+BENCHMARK(BM_PlayerMove)
+    ->ArgNames({"state", "ticks"})
+    ->ArgsProduct({{static_cast<int>(State::JUMPING), static_cast<int>(State::GROUNDED),
+                    static_cast<int>(State::AIRBORNE)},
+                   {1, 12, 1000}});
+
+// 1000 ticks of Player::move by the rules of each version, every tick through update() or repeated. The rules are
+// constants of each instantiation, so every version should run as fast as 1.8 alone did.
+void BM_PlayerMoveVersion(benchmark::State& state) {
+    Player start;
+    start.setVersion(static_cast<Player::Version>(state.range(0)));
+    start.stepExecution = state.range(1);
+    start.keys = keyMask("wa");
+    for (auto _ : state) {
+        Player player = start;
+        player.move(1000, std::nullopt, 0.0f, std::nullopt, true, true, std::nullopt, std::nullopt, State::JUMPING);
+        benchmark::DoNotOptimize(player.position);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+BENCHMARK(BM_PlayerMoveVersion)->ArgNames({"version", "step"})->ArgsProduct({{0, 1, 2}, {1, 0}});
+
+// Whole scripts through the optimizer, compiler and VM, the way sim runs them.
+void runScript(benchmark::State& state, const std::string& source) {
+    for (auto _ : state) {
+        Script script = parse(source);
+        Compiler compiler;
+        VM vm(compiler.compile(script), discard());
+        vm.run();
+    }
+}
+
+void BM_ScriptJumps(benchmark::State& state) {
+    runScript(state,
+              "facing 30.3 stopjump walkair.s 0 sneak.s 4 stop stopjump outvz sprintair outz outvz sprintair 10 "
+              "| sprintjump 12 outx outz | sprint 5 sprintjump 1 sprintair45 11 outz xmm zmm xb zb "
+              "| facing -44 sprint 7 17.3 sprintjump 12 -170.0 outx outz");
+}
+BENCHMARK(BM_ScriptJumps);
+
+void BM_ScriptMomentumLoop(benchmark::State& state) {
+    runScript(state, "let i = 0 while i < 200 { | sprint i / 10 sprintjump 12 sprintair45 11 zb i = i + 1 }");
+}
+BENCHMARK(BM_ScriptMomentumLoop);
+
+void BM_ScriptOptimize(benchmark::State& state) {
+    runScript(state, "optimize angle -45.0 45.0 0.5 { facing angle sprintjump 12 sprintair 11 } maximize z outz");
+}
+BENCHMARK(BM_ScriptOptimize);
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,393 @@
+#include "builtins.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+
+static constexpr std::pair<std::string_view, Builtin> BUILTINS[] = {
+    {"|", Builtin::Reset},     {"facing", Builtin::Facing}, {"f", Builtin::Facing},     {"outx", Builtin::OutX},
+    {"outz", Builtin::OutZ},   {"xmm", Builtin::XMM},       {"zmm", Builtin::ZMM},      {"xb", Builtin::XB},
+    {"zb", Builtin::ZB},       {"outvx", Builtin::OutVX},   {"outvz", Builtin::OutVZ},  {"setx", Builtin::SetX},
+    {"setz", Builtin::SetZ},   {"setvx", Builtin::SetVX},   {"setvz", Builtin::SetVZ},  {"print", Builtin::Print},
+    {"flush", Builtin::Flush}, {"record", Builtin::Record}, {"history", Builtin::History}, {"save", Builtin::Save},
+    {"restore", Builtin::Restore}, {"version", Builtin::Version},
+};
+
+std::optional<Builtin> findBuiltin(std::string_view identifier) {
+    for (const auto& [name, builtin] : BUILTINS) {
+        if (name == identifier) return builtin;
+    }
+    return std::nullopt;
+}
+
+std::string_view builtinName(Builtin builtin) {
+    for (const auto& [name, candidate] : BUILTINS) {
+        if (candidate == builtin) return name;
+    }
+    return {};
+}
+
+bool isOutputBuiltin(Builtin builtin) {
+    switch (builtin) {
+        case Builtin::Reset:
+        case Builtin::Facing:
+        case Builtin::SetX:
+        case Builtin::SetZ:
+        case Builtin::SetVX:
+        case Builtin::SetVZ:
+        case Builtin::Save:
+        case Builtin::Restore:
+        case Builtin::Version:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// What an out builtin reports about `value`, and how far it is from the argument if there is one.
+template <typename T>
+static Output::Measurement measure(Builtin builtin, T value, const std::vector<Value>& args) {
+    Output::Measurement measurement{builtin, static_cast<double>(value), std::nullopt, 0.0};
+    if (args.size() > 0) {
+        measurement.offset = args[0];
+        measurement.difference = std::visit(
+            overloaded{[value](int offset) -> double { return offset - value; },
+                       [value](float offset) -> double { return offset - value; },
+                       [](bool) -> double { throw std::runtime_error("Expected float got bool instead"); },
+                       [](const std::string&) -> double {
+                           throw std::runtime_error("Expected float got string instead");
+                       }},
+            args[0]);
+    }
+    return measurement;
+}
+
+// The mm and b distances take the player's width off or add it, in float.
+static float mmDistance(float pos) {
+    if (pos >= 0.6f) return pos - 0.6f;
+    if (pos <= -0.6f) return pos + 0.6f;
+    return 0.0f;
+}
+
+static float blockDistance(float pos) { return pos >= 0.0f ? pos + 0.6f : pos - 0.6f; }
+
+// The name `save` and `restore` are given, "" without one.
+static std::string snapshotName(const std::vector<Value>& args) {
+    if (args.empty()) return {};
+    if (const std::string* name = std::get_if<std::string>(&args[0])) return *name;
+    throw std::runtime_error("Expected a string name");
+}
+
+void callBuiltin(Builtin builtin, Player& player, const std::vector<Value>& args, Output& output, Recorder& recorder,
+                 Snapshots& snapshots) {
+    switch (builtin) {
+        case Builtin::Reset: {
+            player.position.x = 0.0f;
+            player.position.z = 0.0f;
+            return;
+        }
+        case Builtin::Facing: {
+            if (args.size() > 0) {
+                std::visit(overloaded{[&player](int val) { player.face(static_cast<float>(val)); },
+                                      [&player](float val) { player.face(val); },
+                                      [](bool) { throw std::runtime_error("Expected float got bool instead"); },
+                                      [](std::string) {
+                                          throw std::runtime_error("Expected float got string instead");
+                                      }},
+                           args[0]);
+            } else {
+                player.face(0.0f);
+            }
+            return;
+        }
+        case Builtin::SetX: {
+            if (args.size() > 0) {
+                std::visit(overloaded{[&player](int offset) { player.position.x = static_cast<float>(offset); },
+                                      [&player](float offset) { player.position.x = offset; },
+                                      [](bool) { throw std::runtime_error("Expected float got bool instead"); },
+                                      [](std::string) {
+                                          throw std::runtime_error("Expected float got string instead");
+                                      }},
+                           args[0]);
+            } else {
+                player.position.x = 0.0f;
+            }
+            return;
+        }
+        case Builtin::SetZ: {
+            if (args.size() > 0) {
+                std::visit(overloaded{[&player](int offset) { player.position.z = static_cast<float>(offset); },
+                                      [&player](float offset) { player.position.z = offset; },
+                                      [](bool) { throw std::runtime_error("Expected float got bool instead"); },
+                                      [](std::string) {
+                                          throw std::runtime_error("Expected float got string instead");
+                                      }},
+                           args[0]);
+            } else {
+                player.position.z = 0.0f;
+            }
+            return;
+        }
+        case Builtin::SetVX: {
+            if (args.size() > 0) {
+                std::visit(overloaded{[&player](int offset) { player.velocity.x = static_cast<float>(offset); },
+                                      [&player](float offset) { player.velocity.x = offset; },
+                                      [](bool) { throw std::runtime_error("Expected float got bool instead"); },
+                                      [](std::string) {
+                                          throw std::runtime_error("Expected float got string instead");
+                                      }},
+                           args[0]);
+            } else {
+                player.velocity.x = 0.0f;
+            }
+            return;
+        }
+        case Builtin::SetVZ: {
+            if (args.size() > 0) {
+                std::visit(overloaded{[&player](int offset) { player.velocity.z = static_cast<float>(offset); },
+                                      [&player](float offset) { player.velocity.z = offset; },
+                                      [](bool) { throw std::runtime_error("Expected float got bool instead"); },
+                                      [](std::string) {
+                                          throw std::runtime_error("Expected float got string instead");
+                                      }},
+                           args[0]);
+            } else {
+                player.velocity.z = 0.0f;
+            }
+            return;
+        }
+        case Builtin::OutX:
+            output.measurement(measure(builtin, player.position.x, args), player.precision);
+            return;
+        case Builtin::OutZ:
+            output.measurement(measure(builtin, player.position.z, args), player.precision);
+            return;
+        case Builtin::XMM:
+            output.measurement(measure(builtin, mmDistance(player.position.x), args), player.precision);
+            return;
+        case Builtin::ZMM:
+            output.measurement(measure(builtin, mmDistance(player.position.z), args), player.precision);
+            return;
+        case Builtin::XB:
+            output.measurement(measure(builtin, blockDistance(player.position.x), args), player.precision);
+            return;
+        case Builtin::ZB:
+            output.measurement(measure(builtin, blockDistance(player.position.z), args), player.precision);
+            return;
+        case Builtin::OutVX:
+            output.measurement(measure(builtin, player.velocity.x, args), player.precision);
+            return;
+        case Builtin::OutVZ:
+            output.measurement(measure(builtin, player.velocity.z, args), player.precision);
+            return;
+        case Builtin::Print: {
+            if (args.size() > 0) {
+                output.print(args);
+            } else {
+                throw std::runtime_error("Nothing to print");
+            }
+            return;
+        }
+        case Builtin::Flush:
+            output.flush();
+            return;
+        case Builtin::Record: {
+            // Nothing is recorded while the output is muted, so optimize searches don't wipe the history.
+            if (output.muted()) return;
+            size_t capacity = Recorder::DEFAULT_CAPACITY;
+            if (args.size() > 0) {
+                capacity = std::visit(overloaded{[](int ticks) -> size_t {
+                                                     if (ticks < 0) throw std::runtime_error("Negative record size");
+                                                     return ticks;
+                                                 },
+                                                 [](auto) -> size_t { throw std::runtime_error("Expected int"); }},
+                                      args[0]);
+            }
+            // Stopping keeps what was recorded for history.
+            if (capacity == 0) {
+                player.recorder = nullptr;
+                return;
+            }
+            recorder.start(capacity);
+            player.recorder = &recorder;
+            return;
+        }
+        case Builtin::History:
+            output.history(recorder, player.precision);
+            return;
+        case Builtin::Save:
+            snapshots.insert_or_assign(snapshotName(args), player);
+            return;
+        case Builtin::Restore: {
+            auto found = snapshots.find(snapshotName(args));
+            if (found == snapshots.end()) throw std::runtime_error("Nothing saved to restore");
+            // Recording goes on, or stays off, whatever it was when the snapshot was taken.
+            Recorder* attached = player.recorder;
+            player = found->second;
+            player.recorder = attached;
+            return;
+        }
+        case Builtin::Version: {
+            const std::string* name = args.empty() ? nullptr : std::get_if<std::string>(&args[0]);
+            if (!name) throw std::runtime_error("Expected a version like '1.12'");
+            // Strings keep their quotes.
+            std::string_view text = std::string_view(*name).substr(1, name->size() - 2);
+            std::optional<Player::Version> version = Player::findVersion(text);
+            if (!version.has_value()) throw std::runtime_error("Unknown version " + std::string(text));
+            player.setVersion(version.value());
+            return;
+        }
+    }
+}
+
+static bool stringCheck(std::string_view& str, std::string_view sub) {
+    if (str.starts_with(sub)) {
+        str.remove_prefix(sub.length());
+        return true;
+    }
+    return false;
+}
+
+Movement decodeMovement(std::string_view identifier, std::string_view inputs) {
+    Movement movement;
+    if (!inputs.empty()) movement.keys = keyMask(inputs);
+    // std::vector<std::vector<std::string>> keywords{{"sneak"}, {"walk", "sprint", "stop"}, {"jump", "air", "ground"}};
+    if (stringCheck(identifier, "sneak") || stringCheck(identifier, "sn")) {
+        movement.isSneaking = true;
+    }
+    if (stringCheck(identifier, "stop") || stringCheck(identifier, "st")) {
+        movement.keys = 0;
+    } else if (stringCheck(identifier, "sprint") || stringCheck(identifier, "s")) {
+        movement.isSprinting = true;
+    } else {
+        stringCheck(identifier, "walk") || stringCheck(identifier, "w");
+    }
+    if (stringCheck(identifier, "jump") || stringCheck(identifier, "j")) {
+        movement.state = State::JUMPING;
+    } else if (stringCheck(identifier, "air") || stringCheck(identifier, "a")) {
+        movement.state = State::AIRBORNE;
+        movement.slipperiness = 1.0f;
+    }
+    if (stringCheck(identifier, "45")) movement.offset = 45.0f;
+    return movement;
+}
+
+std::optional<Player::Modifiers> findModifier(std::string_view name) {
+    if (name == "water") return Player::Modifiers::WATER;
+    if (name == "lava") return Player::Modifiers::LAVA;
+    if (name == "web") return Player::Modifiers::WEB;
+    if (name == "block") return Player::Modifiers::BLOCK;
+    if (name == "ladder") return Player::Modifiers::LADDER;
+    if (name == "soulsand") return Player::Modifiers::SOULSAND;
+    return std::nullopt;
+}
+
+void performMovement(Player& player, const Movement& movement, int duration, std::optional<float> rotation, bool tap) {
+    const auto& [keys, slipperiness, offset, state, isSprinting, isSneaking, modifiers] = movement;
+    player.keys = keys;
+    player.setModifiers(modifiers);
+    if (tap) {
+        for (int i = 0; i < duration; i++) {
+            player.move(1, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt, state);
+            player.keys = 0;
+            while (player.velocity.sqrMagnitude() > 0.0) {
+                player.move(1, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
+                            state);
+            }
+            player.keys = keys;
+        }
+    } else if (offset == 45.0f && state == State::JUMPING && isSprinting) {
+        player.move(1, rotation, 0.0f, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt, state);
+        player.move(duration - 1, rotation, offset, 1.0f, isSprinting, isSneaking, std::nullopt, std::nullopt,
+                    State::AIRBORNE);
+    } else {
+        player.move(duration, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
+                    state);
+    }
+}
+
+void performMovement(PlayerBatch& batch, const Movement& movement, int duration, std::optional<float> rotation) {
+    const auto& [keys, slipperiness, offset, state, isSprinting, isSneaking, modifiers] = movement;
+    batch.keys = keys;
+    batch.setModifiers(modifiers);
+    if (offset == 45.0f && state == State::JUMPING && isSprinting) {
+        batch.move(1, rotation, 0.0f, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt, state);
+        batch.move(duration - 1, rotation, offset, 1.0f, isSprinting, isSneaking, std::nullopt, std::nullopt,
+                   State::AIRBORNE);
+    } else {
+        batch.move(duration, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
+                   state);
+    }
+}
+
+static double rangeBound(const Value& value) {
+    return std::visit(overloaded{[](int value) { return static_cast<double>(value); },
+                                 [](float value) { return static_cast<double>(value); },
+                                 [](auto) -> double { throw std::runtime_error("Invalid range for optimize"); }},
+                      value);
+}
+
+SearchRange makeSearchRange(const Value& from, const Value& to, const Value& step) {
+    SearchRange range;
+    range.from = rangeBound(from);
+    range.step = rangeBound(step);
+    double last = rangeBound(to);
+    if (!(range.step > 0.0)) throw std::runtime_error("Invalid step for optimize");
+
+    range.integer =
+        std::holds_alternative<int>(from) && std::holds_alternative<int>(to) && std::holds_alternative<int>(step);
+    if (last < range.from) return range;
+    if (range.integer) {
+        range.count = static_cast<size_t>((std::get<int>(to) - std::get<int>(from)) / std::get<int>(step)) + 1;
+    } else {
+        // Tolerates the rounding of steps like 0.1 so the last value isn't lost.
+        range.count = static_cast<size_t>(std::floor((last - range.from) / range.step + 1e-6)) + 1;
+    }
+    return range;
+}
+
+Value SearchRange::at(size_t index) const {
+    double value = from + static_cast<double>(index) * step;
+    if (integer) return static_cast<int>(value);
+    return static_cast<float>(value);
+}
+
+size_t countCandidates(const std::vector<SearchRange>& ranges) {
+    constexpr size_t limit = size_t(1) << 40;
+    size_t count = 1;
+    for (const auto& range : ranges) {
+        if (range.count != 0 && count > limit / range.count) {
+            throw std::runtime_error("Too many candidates for optimize");
+        }
+        count *= range.count;
+    }
+    return count;
+}
+
+std::vector<Value> candidateValues(const std::vector<SearchRange>& ranges, size_t index) {
+    std::vector<Value> values(ranges.size());
+    for (size_t i = ranges.size(); i-- > 0;) {
+        values[i] = ranges[i].at(index % ranges[i].count);
+        index /= ranges[i].count;
+    }
+    return values;
+}
+
+std::optional<double> scoreObjective(OptimizeStmt::Goal goal, const Value& objective) {
+    if (goal == OptimizeStmt::Goal::Until) {
+        if (const bool* reached = std::get_if<bool>(&objective); reached && *reached) return 1.0;
+        return std::nullopt;
+    }
+    double score;
+    if (const int* value = std::get_if<int>(&objective)) {
+        score = *value;
+    } else if (const float* value = std::get_if<float>(&objective)) {
+        score = *value;
+    } else {
+        return std::nullopt;
+    }
+    if (std::isnan(score)) return std::nullopt;
+    return goal == OptimizeStmt::Goal::Maximize ? score : -score;
+}
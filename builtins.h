@@ -0,0 +1,62 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.h"
+#include "parser.h"
+#include "player.h"
+#include "playerbatch.h"
+#include "recorder.h"
+
+template <typename... Ts>
+struct overloaded : Ts... {
+    using Ts::operator()...;
+};
+template <typename... Ts>
+overloaded(Ts...) -> overloaded<Ts...>;
+
+// Builtins that write to the Output or the Recorder, the rest are safe to call from optimize workers.
+bool isOutputBuiltin(Builtin builtin);
+// `record [ticks]` starts recording every tick of `player` into `recorder`, record 0 stops and keeps what was recorded.
+// `history` writes what it holds to `output`. `save ['name']` copies the whole player into `snapshots`,
+// `restore ['name']` copies it back. `version '1.12'` makes the player move by the rules of that game version, 1.8
+// until then.
+void callBuiltin(Builtin builtin, Player& player, const std::vector<Value>& args, Output& output, Recorder& recorder,
+                 Snapshots& snapshots);
+
+void performMovement(Player& player, const Movement& movement, int duration, std::optional<float> rotation, bool tap);
+// The same for every lane of a batch, without tapping.
+void performMovement(PlayerBatch& batch, const Movement& movement, int duration, std::optional<float> rotation);
+
+// The values one parameter of an optimize statement takes, `from` to `to` inclusive. Integer when all three bounds
+// are, float otherwise.
+struct SearchRange {
+    double from = 0.0;
+    double step = 1.0;
+    bool integer = false;
+    size_t count = 0;
+    Value at(size_t index) const;
+};
+
+SearchRange makeSearchRange(const Value& from, const Value& to, const Value& step);
+// Total number of candidates, throws when the search is unreasonably large.
+size_t countCandidates(const std::vector<SearchRange>& ranges);
+// The parameter values of candidate `index`, the last parameter varies fastest.
+std::vector<Value> candidateValues(const std::vector<SearchRange>& ranges, size_t index);
+// Higher is better, nothing if the candidate doesn't count. With Goal::Until any score ends the search.
+std::optional<double> scoreObjective(OptimizeStmt::Goal goal, const Value& objective);
+// The best candidate an optimize worker has seen, ties go to the lowest index so the result doesn't depend on the
+// order the candidates ran in.
+struct BestCandidate {
+    std::optional<size_t> index;
+    double score = 0.0;
+    void offer(size_t candidate, double candidateScore) {
+        if (!index.has_value() || candidateScore > score || (candidateScore == score && candidate < index)) {
+            index = candidate;
+            score = candidateScore;
+        }
+    }
+};
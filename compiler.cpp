@@ -0,0 +1,669 @@
+#include "compiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <string>
+
+static const char* const RECURSION_ERROR =
+    "Recursion is only supported for functions calling themselves and seeing the same variables there";
+
+static bool hasSideEffects(Expr& expr) {
+    if (dynamic_cast<AssignExpr*>(&expr) || dynamic_cast<CallExpr*>(&expr)) return true;
+    if (auto* unary = dynamic_cast<UnaryExpr*>(&expr)) return hasSideEffects(*unary->operand);
+    if (auto* binary = dynamic_cast<BinaryExpr*>(&expr)) {
+        return hasSideEffects(*binary->lhs) || hasSideEffects(*binary->rhs);
+    }
+    return false;
+}
+
+uint32_t Compiler::emit(OpCode op, uint32_t a, uint32_t b, uint32_t c, uint8_t mode) {
+    chunk().code.push_back(Instruction{op, mode, a, b, c});
+    return chunk().code.size() - 1;
+}
+
+uint32_t Compiler::allocTemp() {
+    uint32_t reg = m_state->nextReg++;
+    chunk().numRegisters = std::max(chunk().numRegisters, m_state->nextReg);
+    return reg;
+}
+
+uint32_t Compiler::allocLocal() {
+    uint32_t reg = allocTemp();
+    m_state->localTop = m_state->nextReg;
+    return reg;
+}
+
+void Compiler::pushScope(TapMode tap) {
+    m_state->scopes.push_back(Scope{m_state->locals.size(), m_state->nextReg, m_state->localTop, m_state->tap});
+    m_state->tap = tap;
+}
+
+void Compiler::popScope() {
+    Scope& scope = m_state->scopes.back();
+    m_state->locals.resize(scope.locals);
+    m_state->nextReg = scope.nextReg;
+    m_state->localTop = scope.localTop;
+    m_state->tap = scope.tap;
+    m_state->scopes.pop_back();
+}
+
+uint32_t Compiler::constant(VMValue value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value.i, sizeof(bits));
+    uint64_t key = static_cast<uint64_t>(value.tag) << 32 | bits;
+    auto [it, inserted] = m_constants.try_emplace(key, m_program.constants.size());
+    if (inserted) m_program.constants.push_back(value);
+    return it->second | Instruction::CONSTANT;
+}
+
+uint32_t Compiler::string(const std::string& text) {
+    auto [it, inserted] = m_strings.try_emplace(text, m_program.strings.size());
+    if (inserted) m_program.strings.push_back(text);
+    return it->second;
+}
+
+void Compiler::emitThrow(const std::string& message) { emit(OpCode::Throw, string(message)); }
+
+Compiler::Binding Compiler::resolve(FunctionState& state, std::string_view identifier) {
+    if (std::optional<Field> field = findField(identifier)) {
+        return Binding{Binding::Kind::Field, static_cast<uint32_t>(field.value())};
+    }
+    for (auto it = state.locals.rbegin(); it != state.locals.rend(); it++) {
+        if (it->identifier == identifier) return Binding{Binding::Kind::Local, it->reg, 0, it->fallback};
+    }
+    if (!state.caller) {
+        auto slot = m_slots.find(identifier);
+        return slot == m_slots.end() ? Binding{} : Binding{Binding::Kind::Input, slot->second};
+    }
+    for (auto& [name, binding] : state.outerBindings) {
+        if (name != identifier) continue;
+        if (!m_resolvingFallback) std::erase(state.fallbacksOnly, identifier);
+        return binding;
+    }
+    Binding binding = resolveFromCaller(*state.caller, identifier);
+    state.outerBindings.emplace_back(identifier, binding);
+    if (m_resolvingFallback) state.fallbacksOnly.push_back(identifier);
+    return binding;
+}
+
+// How a function called from `caller` sees the identifier.
+Compiler::Binding Compiler::resolveFromCaller(FunctionState& caller, std::string_view identifier) {
+    return outward(caller, resolve(caller, identifier));
+}
+
+// A binding of `caller` as seen from a function it calls.
+Compiler::Binding Compiler::outward(FunctionState& caller, Binding binding) {
+    switch (binding.kind) {
+        case Binding::Kind::Local:
+            binding.kind = caller.caller ? Binding::Kind::Up : Binding::Kind::Global;
+            binding.depth = caller.caller ? 1 : 0;
+            break;
+        case Binding::Kind::Up:
+            binding.depth++;
+            break;
+        default:
+            break;
+    }
+    if (binding.fallback != NO_FALLBACK) binding.fallback = fallback(outward(caller, m_fallbacks[binding.fallback]));
+    return binding;
+}
+
+uint32_t Compiler::fallback(const Binding& binding) {
+    auto it = std::find(m_fallbacks.begin(), m_fallbacks.end(), binding);
+    if (it == m_fallbacks.end()) it = m_fallbacks.insert(it, binding);
+    return it - m_fallbacks.begin();
+}
+
+// Whether reading the binding has to test for a failed let. An unset local that shadows nothing fails to read the
+// way an unresolved name does, only assigning it has to be tested.
+bool Compiler::guarded(const Binding& binding) const {
+    return binding.fallback != NO_FALLBACK && m_fallbacks[binding.fallback].kind != Binding::Kind::Unresolved;
+}
+
+uint32_t Compiler::emitJumpIfSet(const Binding& binding) {
+    uint8_t mode = binding.kind == Binding::Kind::Local ? 0 : binding.kind == Binding::Kind::Global ? 1 : 2;
+    return emit(OpCode::JumpIfSet, binding.slot, 0, binding.depth, mode);
+}
+
+void Compiler::emitRead(const Binding& binding, uint32_t target) {
+    if (guarded(binding)) {
+        Binding shadowed = m_fallbacks[binding.fallback];
+        uint32_t set = emitJumpIfSet(binding);
+        emitRead(shadowed, target);
+        uint32_t exit = emit(OpCode::Jump);
+        patch(set, here());
+        emitRead(Binding{binding.kind, binding.slot, binding.depth}, target);
+        patch(exit, here());
+        return;
+    }
+    switch (binding.kind) {
+        case Binding::Kind::Unresolved:
+            emitThrow("Variable not recognized");
+            break;
+        case Binding::Kind::Local:
+            emit(OpCode::Move, target, binding.slot);
+            break;
+        case Binding::Kind::Global:
+            emit(OpCode::GetGlobal, target, binding.slot);
+            break;
+        case Binding::Kind::Input:
+            emit(OpCode::GetInput, target, binding.slot);
+            break;
+        case Binding::Kind::Up:
+            emit(OpCode::GetUp, target, binding.slot, binding.depth);
+            break;
+        case Binding::Kind::Field:
+            emit(OpCode::GetField, target, binding.slot);
+            break;
+    }
+}
+
+// Assigning a variable that isn't defined fails before the value is evaluated.
+void Compiler::emitAssignCheck(const Binding& binding) {
+    switch (binding.kind) {
+        case Binding::Kind::Unresolved:
+            emitThrow("Undefined variable");
+            break;
+        case Binding::Kind::Input:
+            emit(OpCode::CheckInput, binding.slot);
+            break;
+        default:
+            if (binding.fallback != NO_FALLBACK) {
+                Binding shadowed = m_fallbacks[binding.fallback];
+                uint32_t set = emitJumpIfSet(binding);
+                emitAssignCheck(shadowed);
+                patch(set, here());
+            }
+            break;
+    }
+}
+
+void Compiler::emitWrite(const Binding& binding, uint32_t value) {
+    if (guarded(binding)) {
+        Binding shadowed = m_fallbacks[binding.fallback];
+        uint32_t set = emitJumpIfSet(binding);
+        emitWrite(shadowed, value);
+        uint32_t exit = emit(OpCode::Jump);
+        patch(set, here());
+        emitWrite(Binding{binding.kind, binding.slot, binding.depth}, value);
+        patch(exit, here());
+        return;
+    }
+    switch (binding.kind) {
+        case Binding::Kind::Local:
+            emit(OpCode::Move, binding.slot, value);
+            break;
+        case Binding::Kind::Global:
+            emit(OpCode::SetGlobal, binding.slot, value);
+            break;
+        case Binding::Kind::Input:
+            emit(OpCode::SetInput, binding.slot, value);
+            break;
+        case Binding::Kind::Up:
+            emit(OpCode::SetUp, binding.slot, value, binding.depth);
+            break;
+        default:
+            // Unresolved, emitAssignCheck() has thrown already. Fields are assigned with SetField.
+            break;
+    }
+}
+
+// Finds every declaration up front, a call may reach one that comes later in the script or sits in a body that no
+// call compiles.
+void Compiler::collectFunctions(Stmt* stmt) {
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (Stmt* it : block->statements) collectFunctions(it);
+    } else if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        collectFunctions(ifStmt->thenBranch);
+        collectFunctions(ifStmt->elseBranch);
+    } else if (auto* forStmt = dynamic_cast<ForStmt*>(stmt)) {
+        collectFunctions(forStmt->body);
+    } else if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
+        collectFunctions(whileStmt->body);
+    } else if (auto* optimize = dynamic_cast<OptimizeStmt*>(stmt)) {
+        collectFunctions(optimize->body);
+    } else if (auto* declaration = dynamic_cast<FuncDeclStmt*>(stmt)) {
+        m_functions[declaration->slot].push_back(Function{declaration, {}});
+        collectFunctions(declaration->body);
+    }
+}
+
+uint32_t Compiler::specialize(Function& function) {
+    for (auto& specialization : function.specializations) {
+        if (std::all_of(specialization.bindings.begin(), specialization.bindings.end(), [this](auto& it) {
+                return resolveFromCaller(*m_state, it.first) == it.second;
+            })) {
+            return specialization.chunk;
+        }
+    }
+
+    FuncDeclStmt& declaration = *function.declaration;
+    uint32_t index = m_program.chunks.size();
+    m_program.chunks.emplace_back().name = declaration.identifier;
+
+    FunctionState state;
+    state.caller = m_state;
+    state.chunk = index;
+    state.declaration = &declaration;
+    FunctionState* caller = m_state;
+    uint32_t target = m_target;
+    m_state = &state;
+    m_compiling.push_back(&declaration);
+    for (auto& parameter : declaration.parameters) state.locals.push_back(Local{parameter, allocLocal()});
+    compileStmt(declaration.body);
+    emit(OpCode::Return);
+    // A call from the body runs this chunk again, which is only right if every variable the function sees resolves
+    // the same from there. Not if a local of the body shadows it there or it is a frame further down. A name that is
+    // only the fallback of a let may be shadowed, the let failing in the recursive call is all that would tell.
+    for (auto& [guard, locals] : state.recursions) {
+        bool same = std::all_of(state.outerBindings.begin(), state.outerBindings.end(), [&](auto& it) {
+            bool shadowed = std::find(locals.begin(), locals.end(), it.first) != locals.end();
+            bool fallbackOnly = std::find(state.fallbacksOnly.begin(), state.fallbacksOnly.end(), it.first) !=
+                                state.fallbacksOnly.end();
+            return (!shadowed || fallbackOnly) && outward(state, it.second) == it.second;
+        });
+        if (!same) chunk().code[guard] = Instruction{OpCode::Throw, 0, string(RECURSION_ERROR)};
+    }
+    m_compiling.pop_back();
+    m_state = caller;
+    m_target = target;
+
+    function.specializations.push_back(Specialization{index, std::move(state.outerBindings)});
+    return index;
+}
+
+void Compiler::compileStmt(Stmt* stmt) {
+    if (!stmt) return;
+    uint32_t mark = m_state->nextReg;
+    stmt->accept(*this);
+    m_state->nextReg = std::max(mark, m_state->localTop);
+}
+
+uint32_t Compiler::compileExpr(Expr& expr, uint32_t target) {
+    uint32_t saved = m_target;
+    m_target = target;
+    expr.accept(*this);
+    uint32_t result = m_target;
+    m_target = saved;
+    return result;
+}
+
+// Yields a register or constant operand. Locals are read in place unless `clobbered`, i.e. the operand that is
+// evaluated after this one could assign to them.
+uint32_t Compiler::compileOperand(Expr& expr, bool clobbered, Type& type) {
+    if (auto* literal = dynamic_cast<LiteralExpr*>(&expr)) {
+        try {
+            if (std::optional<uint32_t> operand = literalConstant(*literal, type)) return operand.value();
+        } catch (std::exception&) {
+            // Compiled into a throw by visitLiteralExpr below.
+        }
+    }
+    if (auto* var = dynamic_cast<VarExpr*>(&expr); var && !clobbered) {
+        Binding binding = resolve(*m_state, var->identifier);
+        if (binding.kind == Binding::Kind::Local && !guarded(binding)) {
+            type = Type::Dynamic;
+            return binding.slot;
+        }
+    }
+    uint32_t reg = compileExpr(expr, allocTemp());
+    type = m_type;
+    return reg;
+}
+
+uint32_t Compiler::compileArguments(CallExpr& expr, size_t count) {
+    uint32_t base = m_state->nextReg;
+    for (size_t i = 0; i < count; i++) allocTemp();
+    for (size_t i = 0; i < count; i++) compileExpr(*expr.arguments[i], base + i);
+    return base;
+}
+
+std::optional<uint32_t> Compiler::literalConstant(LiteralExpr& expr, Type& type) {
+    Value value = expr.evaluate();
+    type = expr.staticType();
+    switch (expr.type) {
+        case LiteralExpr::Type::Integer:
+            return constant(VMValue::integer(std::get<int>(value)));
+        case LiteralExpr::Type::Float:
+            return constant(VMValue::floating(std::get<float>(value)));
+        case LiteralExpr::Type::Boolean:
+            return constant(VMValue::boolean(std::get<bool>(value)));
+        case LiteralExpr::Type::String:
+            return constant(VMValue::string(string(std::get<std::string>(value))));
+    }
+    return std::nullopt;
+}
+
+OptionalValue Compiler::visitLiteralExpr(LiteralExpr& expr) {
+    if (m_target == NO_REG) m_target = allocTemp();
+    m_type = Type::Dynamic;
+    try {
+        emit(OpCode::LoadK, m_target, literalConstant(expr, m_type).value());
+    } catch (std::exception& e) {
+        // Out of range literals fail when they are evaluated, not when the script is loaded.
+        emitThrow(e.what());
+    }
+    return std::nullopt;
+}
+
+OptionalValue Compiler::visitVarExpr(VarExpr& expr) {
+    Binding binding = resolve(*m_state, expr.identifier);
+    if (m_target == NO_REG) m_target = allocTemp();
+    m_type = binding.kind == Binding::Kind::Field ? Type::Float : Type::Dynamic;
+    emitRead(binding, m_target);
+    return std::nullopt;
+}
+
+OptionalValue Compiler::visitAssignExpr(AssignExpr& expr) {
+    Binding binding = resolve(*m_state, expr.identifier);
+    m_type = Type::Dynamic;
+    if (binding.kind == Binding::Kind::Unresolved) {
+        emitThrow("Undefined variable");
+        return std::nullopt;
+    }
+    if (binding.kind == Binding::Kind::Field) {
+        Type type;
+        uint32_t value = compileOperand(*expr.value, false, type);
+        if (m_target == NO_REG) m_target = allocTemp();
+        emit(OpCode::SetField, binding.slot, value, m_target);
+        m_type = Type::Float;
+        return std::nullopt;
+    }
+    emitAssignCheck(binding);
+
+    // Values that may be none are checked before they are stored, like the tree-walker does.
+    bool check = dynamic_cast<VarExpr*>(expr.value) || dynamic_cast<CallExpr*>(expr.value);
+    if (binding.kind == Binding::Kind::Local && !guarded(binding) && !check) {
+        compileExpr(*expr.value, binding.slot);
+        if (m_target == NO_REG) {
+            m_target = binding.slot;
+        } else {
+            emit(OpCode::Move, m_target, binding.slot);
+        }
+        return std::nullopt;
+    }
+    uint32_t value = compileExpr(*expr.value, allocTemp());
+    if (check) emit(OpCode::Check, value);
+    emitWrite(binding, value);
+    if (m_target == NO_REG) {
+        m_target = value;
+    } else {
+        emit(OpCode::Move, m_target, value);
+    }
+    return std::nullopt;
+}
+
+OptionalValue Compiler::visitUnaryExpr(UnaryExpr& expr) {
+    Type type;
+    uint32_t operand = compileOperand(*expr.operand, false, type);
+    if (m_target == NO_REG) m_target = allocTemp();
+    emit(expr.op == Operator::Subtract ? OpCode::Neg : OpCode::Plus, m_target, operand);
+    m_type = type == Type::Integer || type == Type::Float ? type : Type::Dynamic;
+    return std::nullopt;
+}
+
+OptionalValue Compiler::visitBinaryExpr(BinaryExpr& expr) {
+    struct Opcodes {
+        OpCode generic;
+        OpCode integer;
+        OpCode floating;
+        bool arithmetic;
+    };
+    // By Operator.
+    static constexpr Opcodes opcodes[] = {
+        {OpCode::Add, OpCode::AddII, OpCode::AddFF, true},
+        {OpCode::Sub, OpCode::SubII, OpCode::SubFF, true},
+        {OpCode::Mul, OpCode::MulII, OpCode::MulFF, true},
+        {OpCode::Div, OpCode::DivII, OpCode::DivFF, true},
+        {OpCode::Lt, OpCode::LtII, OpCode::LtFF, false},
+        {OpCode::Gt, OpCode::GtII, OpCode::GtFF, false},
+        {OpCode::Le, OpCode::LeII, OpCode::LeFF, false},
+        {OpCode::Ge, OpCode::GeII, OpCode::GeFF, false},
+        {OpCode::Eq, OpCode::EqII, OpCode::EqFF, false},
+        {OpCode::Ne, OpCode::NeII, OpCode::NeFF, false},
+        {OpCode::And, OpCode::And, OpCode::And, false},
+        {OpCode::Or, OpCode::Or, OpCode::Or, false},
+    };
+    const Opcodes* op = &opcodes[static_cast<size_t>(expr.op)];
+
+    // The right operand is evaluated first, which is the order the tree-walker has always used.
+    Type rhsType, lhsType;
+    uint32_t rhs = compileOperand(*expr.rhs, hasSideEffects(*expr.lhs), rhsType);
+    uint32_t lhs = compileOperand(*expr.lhs, false, lhsType);
+    if (m_target == NO_REG) m_target = allocTemp();
+
+    OpCode opcode = op->generic;
+    if (lhsType == Type::Integer && rhsType == Type::Integer) {
+        opcode = op->integer;
+    } else if (lhsType == Type::Float && rhsType == Type::Float) {
+        opcode = op->floating;
+    }
+    emit(opcode, m_target, lhs, rhs);
+
+    bool numeric = (lhsType == Type::Integer || lhsType == Type::Float) &&
+                   (rhsType == Type::Integer || rhsType == Type::Float);
+    if (!op->arithmetic) {
+        m_type = Type::Boolean;
+    } else if (numeric) {
+        m_type = lhsType == Type::Integer && rhsType == Type::Integer ? Type::Integer : Type::Float;
+    } else {
+        m_type = Type::Dynamic;
+    }
+    return std::nullopt;
+}
+
+// Skips to the declaration of the function that was executed first. Until one has, the name is a movement like
+// anywhere else.
+void Compiler::compileFunctionCall(CallExpr& expr, std::vector<Function>& functions) {
+    uint32_t dispatch = emit(OpCode::Dispatch, expr.slot);
+    for (size_t i = 0; i <= functions.size(); i++) emit(OpCode::Jump);
+    uint32_t mark = m_state->nextReg;
+    std::vector<uint32_t> exits;
+    patch(dispatch + 1, here());
+    compileCommand(expr);
+    for (size_t i = 0; i < functions.size(); i++) {
+        exits.push_back(emit(OpCode::Jump));
+        m_state->nextReg = mark;
+        patch(dispatch + 2 + i, here());
+        Function& function = functions[i];
+        size_t count = function.declaration->parameters.size();
+        if (expr.arguments.size() < count) {
+            emitThrow("Not enough arguments");
+        } else if (m_state->declaration == function.declaration) {
+            // The instruction in front does nothing, unless specialize() finds the call can't run this chunk.
+            uint32_t guard = emit(OpCode::Jump, 0, here() + 1);
+            std::vector<std::string_view> locals;
+            for (const Local& local : m_state->locals) locals.push_back(local.identifier);
+            m_state->recursions.emplace_back(guard, std::move(locals));
+            uint32_t base = compileArguments(expr, count);
+            emit(OpCode::Call, m_state->chunk, base, count, static_cast<uint8_t>(m_state->tap));
+        } else if (std::find(m_compiling.begin(), m_compiling.end(), function.declaration) != m_compiling.end()) {
+            emitThrow(RECURSION_ERROR);
+        } else {
+            uint32_t base = compileArguments(expr, count);
+            uint32_t chunk = specialize(function);
+            emit(OpCode::Call, chunk, base, count, static_cast<uint8_t>(m_state->tap));
+        }
+    }
+    m_state->nextReg = mark;
+    for (uint32_t exit : exits) patch(exit, here());
+}
+
+// Movements and builtins.
+void Compiler::compileCommand(CallExpr& expr) {
+    std::optional<Builtin> builtin = expr.builtin;
+    if (builtin == Builtin::Reset) {
+        emit(OpCode::Builtin, static_cast<uint32_t>(Builtin::Reset));
+        return;
+    }
+
+    uint32_t count = expr.arguments.size();
+    uint32_t base = compileArguments(expr, count);
+    if (!builtin.has_value()) {
+        auto& movements = m_program.movements;
+        auto it = std::find(movements.begin(), movements.end(), expr.movement);
+        if (it == movements.end()) it = movements.insert(movements.end(), expr.movement);
+        emit(OpCode::Movement, it - movements.begin(), base, count, static_cast<uint8_t>(m_state->tap));
+    } else if (builtin == Builtin::Facing) {
+        emit(OpCode::Facing, 0, base, count);
+    } else if (builtin == Builtin::SetX || builtin == Builtin::SetZ || builtin == Builtin::SetVX ||
+               builtin == Builtin::SetVZ) {
+        Field field = builtin == Builtin::SetX    ? Field::X
+                      : builtin == Builtin::SetZ  ? Field::Z
+                      : builtin == Builtin::SetVX ? Field::VX
+                                                  : Field::VZ;
+        emit(OpCode::SetPosition, static_cast<uint32_t>(field), base, count);
+    } else {
+        emit(OpCode::Builtin, static_cast<uint32_t>(builtin.value()), base, count);
+    }
+}
+
+OptionalValue Compiler::visitCallExpr(CallExpr& expr) {
+    m_type = Type::Dynamic;
+    if (auto functions = m_functions.find(expr.slot); functions != m_functions.end()) {
+        compileFunctionCall(expr, functions->second);
+    } else {
+        compileCommand(expr);
+    }
+    if (m_target != NO_REG) emit(OpCode::LoadNone, m_target);
+    return std::nullopt;
+}
+
+void Compiler::visitExprStmt(ExprStmt& stmt) { compileExpr(*stmt.expression, NO_REG); }
+
+void Compiler::visitBlockStmt(BlockStmt& stmt) {
+    pushScope(stmt.tap ? TapMode::On : TapMode::Off);
+    for (auto& it : stmt.statements) {
+        uint32_t start = here();
+        compileStmt(it);
+        if (here() > start) chunk().handlers.push_back(Chunk::Handler{start, here()});
+    }
+    popScope();
+}
+
+void Compiler::visitIfStmt(IfStmt& stmt) {
+    Type type;
+    uint32_t condition = compileOperand(*stmt.condition, false, type);
+    if (condition & Instruction::CONSTANT) {
+        uint32_t reg = allocTemp();
+        emit(OpCode::LoadK, reg, condition);
+        condition = reg;
+    }
+    uint32_t jump = emit(OpCode::JumpIfNot, condition, 0, 0, 0);
+    compileStmt(stmt.thenBranch);
+    if (stmt.elseBranch) {
+        uint32_t skip = emit(OpCode::Jump);
+        patch(jump, here());
+        compileStmt(stmt.elseBranch);
+        patch(skip, here());
+    } else {
+        patch(jump, here());
+    }
+}
+
+void Compiler::visitForStmt(ForStmt& stmt) {
+    uint32_t counter = compileExpr(*stmt.condition, allocTemp());
+    uint32_t prepare = emit(OpCode::ForPrep, counter);
+    uint32_t body = here();
+    compileStmt(stmt.body);
+    emit(OpCode::ForLoop, counter, body);
+    patch(prepare, here());
+}
+
+void Compiler::visitWhileStmt(WhileStmt& stmt) {
+    uint32_t start = here();
+    uint32_t mark = m_state->nextReg;
+    Type type;
+    uint32_t condition = compileOperand(*stmt.condition, false, type);
+    if (condition & Instruction::CONSTANT) {
+        uint32_t reg = allocTemp();
+        emit(OpCode::LoadK, reg, condition);
+        condition = reg;
+    }
+    uint32_t exit = emit(OpCode::JumpIfNot, condition, 0, 0, 1);
+    m_state->nextReg = std::max(mark, m_state->localTop);
+    compileStmt(stmt.body);
+    emit(OpCode::Jump, 0, start);
+    patch(exit, here());
+}
+
+void Compiler::visitVarDeclStmt(VarDeclStmt& stmt) {
+    uint32_t reg = allocLocal();
+    // The register may hold a stale temporary, and a failed initializer leaves the variable undeclared.
+    emit(OpCode::LoadK, reg, constant(VMValue{}));
+    compileExpr(*stmt.value, reg);
+    Local local{stmt.identifier, reg};
+    // Until the let has succeeded the name keeps meaning what it meant before, like in the tree-walker.
+    auto* literal = dynamic_cast<LiteralExpr*>(stmt.value);
+    if (!literal || !literal->valid) {
+        m_resolvingFallback = true;
+        local.fallback = fallback(resolve(*m_state, stmt.identifier));
+        m_resolvingFallback = false;
+    }
+    m_state->locals.push_back(local);
+}
+
+void Compiler::visitFuncDeclStmt(FuncDeclStmt& stmt) {
+    std::vector<Function>& functions = m_functions[stmt.slot];
+    auto it = std::find_if(functions.begin(), functions.end(), [&stmt](auto& it) { return it.declaration == &stmt; });
+    emit(OpCode::Declare, stmt.slot, it - functions.begin() + 1);
+}
+
+// The ranges go to consecutive registers, followed by room for the parameters of the candidate chunk. That chunk
+// sees the parameters like a function sees its arguments and leaves the objective in the register after them.
+void Compiler::visitOptimizeStmt(OptimizeStmt& stmt) {
+    uint32_t count = stmt.parameters.size();
+    uint32_t base = m_state->nextReg;
+    for (uint32_t i = 0; i < 4 * count; i++) allocTemp();
+    for (uint32_t i = 0; i < count; i++) {
+        compileExpr(*stmt.parameters[i].from, base + 3 * i);
+        compileExpr(*stmt.parameters[i].to, base + 3 * i + 1);
+        compileExpr(*stmt.parameters[i].step, base + 3 * i + 2);
+    }
+
+    uint32_t index = m_program.chunks.size();
+    m_program.chunks.emplace_back().name = "optimize";
+    FunctionState state;
+    state.caller = m_state;
+    state.chunk = index;
+    FunctionState* caller = m_state;
+    uint32_t target = m_target;
+    m_state = &state;
+    for (auto& parameter : stmt.parameters) state.locals.push_back(Local{parameter.identifier, allocLocal()});
+    uint32_t objective = allocLocal();
+    compileStmt(stmt.body);
+    compileExpr(*stmt.objective, objective);
+    emit(OpCode::Return);
+    m_state = caller;
+    m_target = target;
+    if (m_state->tap != TapMode::On) {
+        m_program.chunks[index].search =
+            planSearch(stmt, [this](const CallExpr& call) { return m_functions.contains(call.slot); });
+    }
+
+    uint8_t mode = static_cast<uint8_t>(m_state->tap) | static_cast<uint8_t>(stmt.goal) << 2;
+    emit(OpCode::Optimize, index, base, count, mode);
+}
+
+Program Compiler::compile(Script& script) {
+    m_program = Program{};
+    m_program.chunks.emplace_back().name = "main";
+    m_constants.clear();
+    m_strings.clear();
+    m_slots.clear();
+    m_fallbacks.clear();
+    for (uint32_t slot = 0; slot < script.names.size(); slot++) {
+        if (!script.names[slot].empty()) m_slots.emplace(script.names[slot], slot);
+    }
+    m_functions.clear();
+    collectFunctions(script.root);
+
+    FunctionState state;
+    state.tap = TapMode::Off;
+    m_state = &state;
+    script.root->accept(*this);
+    emit(OpCode::Return);
+    m_state = nullptr;
+    return std::move(m_program);
+}
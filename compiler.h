@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.h"
+#include "vm.h"
+
+// Compiles a script from Scanner::scan() into register bytecode for the VM. The script must outlive the compiler.
+//
+// Functions see their caller's variables, so a function body is compiled at its call sites, once for every
+// distinct way its free variables resolve there, and those resolutions become fixed frame slots.
+class Compiler : public ExprVisitor, public StmtVisitor {
+   private:
+    static constexpr uint32_t NO_REG = UINT32_MAX;
+    static constexpr uint32_t NO_FALLBACK = UINT32_MAX;
+    using Type = StaticType;
+    struct Binding {
+        enum class Kind : uint8_t { Unresolved, Local, Global, Up, Field, Input };
+        Kind kind = Kind::Unresolved;
+        uint32_t slot = 0;
+        uint32_t depth = 0;
+        // While a local whose let failed is unset, the name means the binding it shadows, see m_fallbacks.
+        uint32_t fallback = NO_FALLBACK;
+        bool operator==(const Binding&) const = default;
+    };
+    struct Local {
+        std::string_view identifier;
+        uint32_t reg;
+        uint32_t fallback = NO_FALLBACK;
+    };
+    struct Scope {
+        size_t locals;
+        uint32_t nextReg;
+        uint32_t localTop;
+        TapMode tap;
+    };
+    struct FunctionState {
+        FunctionState* caller = nullptr;
+        uint32_t chunk = 0;
+        std::vector<Local> locals;
+        std::vector<Scope> scopes;
+        uint32_t nextReg = 0;
+        uint32_t localTop = 0;
+        TapMode tap = TapMode::Inherit;
+        std::vector<std::pair<std::string_view, Binding>> outerBindings;
+        // The function whose body this is, nothing for the script and optimize bodies.
+        FuncDeclStmt* declaration = nullptr;
+        // Calls of the function from its own body, the instruction in front of each and the locals there.
+        std::vector<std::pair<uint32_t, std::vector<std::string_view>>> recursions;
+        // Outer bindings only looked up as the fallback of a let, never read or assigned.
+        std::vector<std::string_view> fallbacksOnly;
+    };
+    struct Specialization {
+        uint32_t chunk;
+        std::vector<std::pair<std::string_view, Binding>> bindings;
+    };
+    struct Function {
+        FuncDeclStmt* declaration;
+        std::vector<Specialization> specializations;
+    };
+
+    Program m_program;
+    std::unordered_map<uint64_t, uint32_t> m_constants;
+    std::unordered_map<std::string, uint32_t> m_strings;
+    FunctionState* m_state = nullptr;
+    // The slot of every name, a name the script doesn't declare is one of the variables given to VM::define().
+    std::unordered_map<std::string_view, uint32_t> m_slots;
+    // The bindings shadowed by locals whose initializer can fail, each one once.
+    std::vector<Binding> m_fallbacks;
+    bool m_resolvingFallback = false;
+    // Every declaration of a function name in the tree, by slot and in source order. Which one a call reaches is
+    // only known when it runs, the first declaration executed wins like in the tree-walker.
+    std::unordered_map<uint32_t, std::vector<Function>> m_functions;
+    // Declarations whose body is being compiled, a call back into one of them can't be specialized.
+    std::vector<FuncDeclStmt*> m_compiling;
+    uint32_t m_target = NO_REG;
+    Type m_type = Type::Dynamic;
+
+   private:
+    Chunk& chunk() { return m_program.chunks[m_state->chunk]; }
+    uint32_t emit(OpCode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint8_t mode = 0);
+    uint32_t here() { return chunk().code.size(); }
+    void patch(uint32_t jump, uint32_t target) { chunk().code[jump].b = target; }
+    uint32_t allocTemp();
+    uint32_t allocLocal();
+    void pushScope(TapMode tap);
+    void popScope();
+
+    uint32_t constant(VMValue value);
+    uint32_t string(const std::string& text);
+    void emitThrow(const std::string& message);
+    std::optional<uint32_t> literalConstant(LiteralExpr& expr, Type& type);
+
+    Binding resolve(FunctionState& state, std::string_view identifier);
+    Binding resolveFromCaller(FunctionState& caller, std::string_view identifier);
+    Binding outward(FunctionState& caller, Binding binding);
+    uint32_t fallback(const Binding& binding);
+    bool guarded(const Binding& binding) const;
+    uint32_t emitJumpIfSet(const Binding& binding);
+    void emitRead(const Binding& binding, uint32_t target);
+    void emitAssignCheck(const Binding& binding);
+    void emitWrite(const Binding& binding, uint32_t value);
+    void collectFunctions(Stmt* stmt);
+    uint32_t specialize(Function& function);
+
+    void compileStmt(Stmt* stmt);
+    uint32_t compileExpr(Expr& expr, uint32_t target);
+    uint32_t compileOperand(Expr& expr, bool clobbered, Type& type);
+    uint32_t compileArguments(CallExpr& expr, size_t count);
+    void compileFunctionCall(CallExpr& expr, std::vector<Function>& functions);
+    void compileCommand(CallExpr& expr);
+
+   public:
+    OptionalValue visitLiteralExpr(LiteralExpr& expr) override;
+    OptionalValue visitVarExpr(VarExpr& expr) override;
+    OptionalValue visitAssignExpr(AssignExpr& expr) override;
+    OptionalValue visitUnaryExpr(UnaryExpr& expr) override;
+    OptionalValue visitBinaryExpr(BinaryExpr& expr) override;
+    OptionalValue visitCallExpr(CallExpr& expr) override;
+
+    void visitExprStmt(ExprStmt& stmt) override;
+    void visitBlockStmt(BlockStmt& stmt) override;
+    void visitIfStmt(IfStmt& stmt) override;
+    void visitForStmt(ForStmt& stmt) override;
+    void visitWhileStmt(WhileStmt& stmt) override;
+    void visitVarDeclStmt(VarDeclStmt& stmt) override;
+    void visitFuncDeclStmt(FuncDeclStmt& stmt) override;
+    void visitOptimizeStmt(OptimizeStmt& stmt) override;
+
+    Program compile(Script& script);
+};
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 enum class TokenType {
     Identifier,
     Builtin,
@@ -36,27 +43,71 @@ enum class TokenType {
     Semicolon,
     EndOfFile,
     Tap,
+    Optimize,
     Unknown,
 };
 
+// The text of names is kept by the lexer and lives as long as it. Literals point into the script, which for a piped one
+// is a buffer the next call to Lexer::next() may overwrite.
 struct Token {
     TokenType type;
-    std::string text;
-    Token(TokenType type, std::string text) : type(type), text(text) {}
+    std::string_view text;
+    // Identifiers, builtins, movements and modifiers spelled the same share an id.
+    uint32_t id = 0;
+    Token(TokenType type, std::string_view text, uint32_t id = 0) : type(type), text(text), id(id) {}
     Token() = default;
 };
 
+// Small ids for the distinct spellings of a script. Names never move once added.
+class Interner {
+   private:
+    std::deque<std::string> m_names;
+    std::unordered_map<std::string_view, uint32_t> m_ids;
+
+   public:
+    uint32_t intern(std::string_view text) {
+        auto it = m_ids.find(text);
+        if (it != m_ids.end()) return it->second;
+        uint32_t id = m_names.size();
+        m_ids.emplace(m_names.emplace_back(text), id);
+        return id;
+    }
+    std::string_view name(uint32_t id) const { return m_names[id]; }
+    size_t size() const { return m_names.size(); }
+};
+
+// Tokenizes a script held in memory, mapped from a file, or read from a pipe one chunk at a time as the scanner
+// asks for tokens, so a generated script can be parsed while its generator is still writing it.
 class Lexer {
    private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
     std::string m_input;
+    std::vector<char> m_buffer;
+    char* m_map = nullptr;
+    size_t m_mapSize = 0;
+    int m_fd = -1;
+    bool m_eof = true;
     const char* m_cursor;
     const char* m_limit;
+    const char* m_marker;
+    const char* m_token;
+    Interner m_names;
+
+   private:
+    bool map(int fd);
+    int fill();
+    std::string_view text();
+    Token interned(TokenType type);
 
    public:
-    Lexer(const std::string& input) : m_input(input) {
-        m_cursor = m_input.c_str();
-        m_limit = m_cursor + m_input.length();
-    }
+    explicit Lexer(const std::string& input);
+    // Reads the script from `fd`, which stays open and owned by the caller. Regular files are mapped, anything else
+    // is read in chunks.
+    explicit Lexer(int fd);
+    ~Lexer();
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
 
     Token next();
+    const Interner& names() const { return m_names; }
 };
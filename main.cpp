@@ -1,10 +1,57 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "output.h"
 #include "parser.h"
+#include "vm.h"
+
+// sim [--format text|binary|csv|ndjson] [script], reads the script from standard input when there is none or it
+// is "-". The output builtins write in the given format, text by default.
+int main(int argc, char** argv) {
+    Output::Format format = Output::Format::Text;
+    int arg = 1;
+    if (argc > arg + 1 && std::string_view(argv[arg]) == "--format") {
+        std::optional<Output::Format> found = Output::findFormat(argv[arg + 1]);
+        if (!found.has_value()) {
+            std::fprintf(stderr, "%s: unknown output format %s\n", argv[0], argv[arg + 1]);
+            return 1;
+        }
+        format = found.value();
+        arg += 2;
+    }
 
-int main() {
-    std::string input =
-        "facing 30.3 stopjump walkair.s 0 sneak.s 4 stop stopjump outvz sprintair outz outvz sprintair 10 sprint 1 "
-        "outz 1 outx -0.4 | sprintjump 9 outz -0.6 outx 0.6";
-    Scanner scanner(input);
-    CodeVisitor visitor;
-    scanner.scan().accept(visitor);
+    int fd = STDIN_FILENO;
+    if (argc > arg && std::string_view(argv[arg]) != "-") {
+        fd = open(argv[arg], O_RDONLY);
+        if (fd < 0) {
+            std::perror(argv[arg]);
+            return 1;
+        }
+    }
+    Program program;
+    try {
+        Scanner scanner(fd);
+        Script script = scanner.scan();
+        Optimizer(*script.arena).optimize(script);
+        program = Compiler().compile(script);
+    } catch (std::exception& e) {
+        // A script that doesn't parse is reported like a statement that fails.
+        std::cerr << "\033[31m" << "ERROR: " << e.what() << "\033[0m" << std::endl;
+        return 1;
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    std::unique_ptr<Output> output = Output::create(format, STDOUT_FILENO);
+    VM vm(std::move(program), *output);
+    vm.run();
+    output->flush();
 }
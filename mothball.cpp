@@ -0,0 +1,172 @@
+#include "mothball.h"
+
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "vm.h"
+
+namespace {
+// Keeps the output builtins as records instead of formatting them.
+class RecordOutput : public Output {
+   private:
+    std::vector<mothball_record>& m_records;
+    std::deque<std::string>& m_texts;
+    // Formats what print prints, like sim does.
+    TextOutput m_text{-1};
+
+   private:
+    void writeMeasurement(const Measurement& measurement, int) override {
+        mothball_record record{builtinName(measurement.builtin).data(), measurement.value, 0, 0.0, 0.0, nullptr};
+        if (measurement.offset.has_value()) {
+            record.has_offset = 1;
+            if (const int* offset = std::get_if<int>(&measurement.offset.value())) record.offset = *offset;
+            if (const float* offset = std::get_if<float>(&measurement.offset.value())) record.offset = *offset;
+            record.difference = measurement.difference;
+        }
+        m_records.push_back(record);
+    }
+
+    void writePrint(const std::vector<Value>& values) override {
+        m_text.print(values);
+        std::string& text = m_texts.emplace_back(m_text.take());
+        text.pop_back();
+        m_records.push_back({builtinName(Builtin::Print).data(), 0.0, 0, 0.0, 0.0, text.c_str()});
+    }
+
+    void writeHistory(const Recorder&, int) override {}
+
+   public:
+    RecordOutput(std::vector<mothball_record>& records, std::deque<std::string>& texts)
+        : Output(-1), m_records(records), m_texts(texts) {}
+};
+}  // namespace
+
+struct mothball_context {
+    std::string source;
+    Script script;
+    // The script compiled once, every run gets a VM of its own.
+    std::shared_ptr<const Program> program;
+    std::unordered_map<std::string, Value> variables;
+    Player::Version version = Player::Version::V1_8;
+    Player player;
+    std::vector<mothball_record> records;
+    // What the print records point to.
+    std::deque<std::string> texts;
+    std::string error;
+};
+
+namespace {
+// Runs `body`, turning what it throws into MOTHBALL_ERROR. Nothing may be thrown across the C API.
+template <typename F>
+int guarded(mothball_context* context, F body) {
+    context->error.clear();
+    try {
+        body();
+        return MOTHBALL_OK;
+    } catch (std::exception& e) {
+        context->error = e.what();
+    } catch (...) {
+        context->error = "Unknown error";
+    }
+    return MOTHBALL_ERROR;
+}
+
+int set(mothball_context* context, const char* name, Value value) {
+    return guarded(context, [&] { context->variables.insert_or_assign(name, std::move(value)); });
+}
+}  // namespace
+
+extern "C" {
+mothball_context* mothball_create(void) { return new (std::nothrow) mothball_context; }
+
+void mothball_destroy(mothball_context* context) { delete context; }
+
+int mothball_load(mothball_context* context, const char* source, size_t length) {
+    return guarded(context, [&] {
+        context->records.clear();
+        context->texts.clear();
+        context->program = nullptr;
+        context->script = Script{};
+        context->source.assign(source, length);
+        Scanner scanner(context->source);
+        Script script = scanner.scan();
+        Optimizer(*script.arena).optimize(script);
+        context->program = std::make_shared<const Program>(Compiler().compile(script));
+        context->script = std::move(script);
+    });
+}
+
+int mothball_set_int(mothball_context* context, const char* name, int value) { return set(context, name, value); }
+
+int mothball_set_float(mothball_context* context, const char* name, float value) { return set(context, name, value); }
+
+int mothball_set_bool(mothball_context* context, const char* name, int value) {
+    return set(context, name, value != 0);
+}
+
+int mothball_set_string(mothball_context* context, const char* name, const char* value) {
+    // Script strings keep their quotes.
+    return set(context, name, "'" + std::string(value) + "'");
+}
+
+int mothball_set_version(mothball_context* context, const char* version) {
+    return guarded(context, [&] {
+        std::optional<Player::Version> found = Player::findVersion(version);
+        if (!found.has_value()) throw std::runtime_error("Unknown version " + std::string(version));
+        context->version = found.value();
+    });
+}
+
+int mothball_run(mothball_context* context) {
+    return guarded(context, [&] {
+        if (!context->program) throw std::runtime_error("No script loaded");
+        context->records.clear();
+        context->texts.clear();
+        RecordOutput output(context->records, context->texts);
+        std::ostringstream errors;
+        VM vm(context->program, output, errors);
+        vm.player().setVersion(context->version);
+        const std::vector<std::string_view>& names = context->script.names;
+        for (uint32_t slot = 0; slot < names.size(); slot++) {
+            if (names[slot].empty()) continue;
+            auto it = context->variables.find(std::string(names[slot]));
+            if (it != context->variables.end()) vm.define(slot, it->second);
+        }
+        vm.run();
+        context->player = vm.player();
+        // The VM's recorder goes with it.
+        context->player.recorder = nullptr;
+        context->error = errors.str();
+    });
+}
+
+void mothball_position(const mothball_context* context, double* x, double* z) {
+    *x = context->player.position.x;
+    *z = context->player.position.z;
+}
+
+void mothball_velocity(const mothball_context* context, double* vx, double* vz) {
+    *vx = context->player.velocity.x;
+    *vz = context->player.velocity.z;
+}
+
+size_t mothball_record_count(const mothball_context* context) { return context->records.size(); }
+
+const mothball_record* mothball_records(const mothball_context* context) { return context->records.data(); }
+
+const char* mothball_error(const mothball_context* context) { return context->error.c_str(); }
+}
@@ -0,0 +1,75 @@
+/* The C API of the simulator, for running scripts in process. Link with libmothball.
+ *
+ * A context holds one loaded script, the variables set on it and what its last run left behind. Contexts share
+ * nothing, so any number of threads can each drive their own, but one context must not be used by two threads at
+ * once. Functions returning int return MOTHBALL_OK, or MOTHBALL_ERROR with the reason in mothball_error().
+ *
+ *   mothball_context* context = mothball_create();
+ *   mothball_load(context, source, strlen(source));
+ *   mothball_set_float(context, "angle", 12.5f);
+ *   mothball_run(context);
+ *   mothball_position(context, &x, &z);
+ */
+#ifndef MOTHBALL_H
+#define MOTHBALL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOTHBALL_OK 0
+#define MOTHBALL_ERROR (-1)
+
+typedef struct mothball_context mothball_context;
+
+/* What one output builtin of the last run wrote, in the order they ran. */
+typedef struct mothball_record {
+    /* The name of the builtin, "outx", "zb", ... or "print". */
+    const char* builtin;
+    /* The measured value, and with an argument the argument and argument - value. */
+    double value;
+    int has_offset;
+    double offset;
+    double difference;
+    /* What print printed, without the newline. NULL for the other builtins. */
+    const char* text;
+} mothball_record;
+
+mothball_context* mothball_create(void);
+void mothball_destroy(mothball_context* context);
+
+/* Parses `length` bytes of script, replacing the one loaded before. The variables set so far are kept. */
+int mothball_load(mothball_context* context, const char* source, size_t length);
+
+/* Variables the script reads without declaring them, bound for every following run. */
+int mothball_set_int(mothball_context* context, const char* name, int value);
+int mothball_set_float(mothball_context* context, const char* name, float value);
+int mothball_set_bool(mothball_context* context, const char* name, int value);
+int mothball_set_string(mothball_context* context, const char* name, const char* value);
+
+/* The game version every following run starts in, "1.8", "1.12" or "1.14", 1.8 until set. Scripts can still switch
+ * with the version builtin. */
+int mothball_set_version(mothball_context* context, const char* version);
+
+/* Runs the loaded script from a new player. A failing statement doesn't stop the run, it is reported in
+ * mothball_error() like sim reports it and the run still returns MOTHBALL_OK. */
+int mothball_run(mothball_context* context);
+
+/* Where the last run left the player. */
+void mothball_position(const mothball_context* context, double* x, double* z);
+void mothball_velocity(const mothball_context* context, double* vx, double* vz);
+
+/* The records of the last run, valid until the next run or load. history is not recorded. */
+size_t mothball_record_count(const mothball_context* context);
+const mothball_record* mothball_records(const mothball_context* context);
+
+/* Why the last call failed, or the statements the last run reported. Empty when there is nothing. */
+const char* mothball_error(const mothball_context* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#include "optimizer.h"
+
+#include <exception>
+#include <string>
+#include <variant>
+
+#include "builtins.h"
+
+static bool isNumeric(StaticType type) { return type == StaticType::Integer || type == StaticType::Float; }
+
+// A literal that evaluates without throwing.
+static LiteralExpr* constant(Expr* expr) {
+    auto* literal = dynamic_cast<LiteralExpr*>(expr);
+    return literal && literal->valid ? literal : nullptr;
+}
+
+Expr* Optimizer::optimize(Expr* expr, StaticType& type) {
+    m_expr = expr;
+    m_type = StaticType::Dynamic;
+    expr->accept(*this);
+    type = m_type;
+    return m_expr;
+}
+
+Expr* Optimizer::optimize(Expr* expr) {
+    StaticType type;
+    return expr ? optimize(expr, type) : nullptr;
+}
+
+void Optimizer::optimize(Stmt* stmt) {
+    if (stmt) stmt->accept(*this);
+}
+
+LiteralExpr* Optimizer::fold(const OptionalValue& value) {
+    LiteralExpr* literal = std::visit(
+        overloaded{[this](int value) { return m_arena.make<LiteralExpr>(value); },
+                   [this](float value) { return m_arena.make<LiteralExpr>(value); },
+                   [this](bool value) { return m_arena.make<LiteralExpr>(value); },
+                   [this](const std::string& value) {
+                       return m_arena.make<LiteralExpr>(LiteralExpr::Type::String, m_arena.copy(value));
+                   }},
+        value.value());
+    m_type = literal->staticType();
+    return literal;
+}
+
+OptionalValue Optimizer::visitLiteralExpr(LiteralExpr& expr) {
+    m_type = expr.staticType();
+    return std::nullopt;
+}
+
+OptionalValue Optimizer::visitVarExpr(VarExpr& expr) {
+    if (expr.field.has_value()) m_type = StaticType::Float;
+    return std::nullopt;
+}
+
+OptionalValue Optimizer::visitAssignExpr(AssignExpr& expr) {
+    StaticType type;
+    expr.value = optimize(expr.value, type);
+    m_expr = &expr;
+    m_type = expr.field.has_value() ? StaticType::Float : type;
+    return std::nullopt;
+}
+
+OptionalValue Optimizer::visitUnaryExpr(UnaryExpr& expr) {
+    StaticType type;
+    expr.operand = optimize(expr.operand, type);
+    m_expr = &expr;
+    m_type = StaticType::Dynamic;
+    if (LiteralExpr* operand = constant(expr.operand)) {
+        try {
+            m_expr = fold(evaluateUnary(expr.op, operand->evaluate()));
+            return std::nullopt;
+        } catch (std::exception&) {
+            // Left for the script to fail on when it gets there.
+        }
+    }
+    if (isNumeric(type)) expr.operands = m_type = type;
+    return std::nullopt;
+}
+
+OptionalValue Optimizer::visitBinaryExpr(BinaryExpr& expr) {
+    StaticType lhsType, rhsType;
+    expr.lhs = optimize(expr.lhs, lhsType);
+    expr.rhs = optimize(expr.rhs, rhsType);
+    m_expr = &expr;
+
+    bool arithmetic = expr.op == Operator::Add || expr.op == Operator::Subtract || expr.op == Operator::Multiply ||
+                      expr.op == Operator::Divide;
+    if (!arithmetic) {
+        m_type = StaticType::Boolean;
+    } else if (lhsType == StaticType::Integer && rhsType == StaticType::Integer) {
+        m_type = StaticType::Integer;
+    } else if (isNumeric(lhsType) && isNumeric(rhsType)) {
+        m_type = StaticType::Float;
+    } else {
+        m_type = StaticType::Dynamic;
+    }
+
+    LiteralExpr* lhs = constant(expr.lhs);
+    LiteralExpr* rhs = constant(expr.rhs);
+    if (lhs && rhs) {
+        try {
+            m_expr = fold(evaluateBinary(expr.op, lhs->evaluate(), rhs->evaluate()));
+            return std::nullopt;
+        } catch (std::exception&) {
+            // Left for the script to fail on when it gets there.
+        }
+    }
+    if (lhsType == rhsType && isNumeric(lhsType)) expr.operands = lhsType;
+    return std::nullopt;
+}
+
+OptionalValue Optimizer::visitCallExpr(CallExpr& expr) {
+    for (Expr*& argument : expr.arguments) argument = optimize(argument);
+    m_expr = &expr;
+    m_type = StaticType::Dynamic;
+    return std::nullopt;
+}
+
+void Optimizer::visitExprStmt(ExprStmt& stmt) { stmt.expression = optimize(stmt.expression); }
+
+void Optimizer::visitBlockStmt(BlockStmt& stmt) {
+    for (Stmt* statement : stmt.statements) optimize(statement);
+}
+
+void Optimizer::visitIfStmt(IfStmt& stmt) {
+    stmt.condition = optimize(stmt.condition);
+    optimize(stmt.thenBranch);
+    optimize(stmt.elseBranch);
+}
+
+void Optimizer::visitForStmt(ForStmt& stmt) {
+    stmt.condition = optimize(stmt.condition);
+    optimize(stmt.body);
+}
+
+void Optimizer::visitWhileStmt(WhileStmt& stmt) {
+    stmt.condition = optimize(stmt.condition);
+    optimize(stmt.body);
+}
+
+void Optimizer::visitVarDeclStmt(VarDeclStmt& stmt) { stmt.value = optimize(stmt.value); }
+
+void Optimizer::visitFuncDeclStmt(FuncDeclStmt& stmt) { optimize(stmt.body); }
+
+void Optimizer::visitOptimizeStmt(OptimizeStmt& stmt) {
+    for (auto& parameter : stmt.parameters) {
+        parameter.from = optimize(parameter.from);
+        parameter.to = optimize(parameter.to);
+        parameter.step = optimize(parameter.step);
+    }
+    optimize(stmt.body);
+    stmt.objective = optimize(stmt.objective);
+}
+
+void Optimizer::optimize(Script& script) { optimize(script.root); }
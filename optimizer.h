@@ -0,0 +1,41 @@
+#pragma once
+
+#include "parser.h"
+
+// Rewrites the tree from Scanner::scan() in place before it runs. Operators whose operands are all literals are
+// folded into a literal, unless evaluating them throws, and unary and binary nodes whose operands have a type known
+// up front get it in `operands`, so the tree-walker can skip the dispatch on it. Folded literals live in the arena.
+class Optimizer : public ExprVisitor, public StmtVisitor {
+   private:
+    Arena& m_arena;
+    // What visiting an expression leaves: the node that replaces it and its type.
+    Expr* m_expr = nullptr;
+    StaticType m_type = StaticType::Dynamic;
+
+   private:
+    Expr* optimize(Expr* expr, StaticType& type);
+    Expr* optimize(Expr* expr);
+    void optimize(Stmt* stmt);
+    LiteralExpr* fold(const OptionalValue& value);
+
+   public:
+    explicit Optimizer(Arena& arena) : m_arena(arena) {}
+
+    OptionalValue visitLiteralExpr(LiteralExpr& expr) override;
+    OptionalValue visitVarExpr(VarExpr& expr) override;
+    OptionalValue visitAssignExpr(AssignExpr& expr) override;
+    OptionalValue visitUnaryExpr(UnaryExpr& expr) override;
+    OptionalValue visitBinaryExpr(BinaryExpr& expr) override;
+    OptionalValue visitCallExpr(CallExpr& expr) override;
+
+    void visitExprStmt(ExprStmt& stmt) override;
+    void visitBlockStmt(BlockStmt& stmt) override;
+    void visitIfStmt(IfStmt& stmt) override;
+    void visitForStmt(ForStmt& stmt) override;
+    void visitWhileStmt(WhileStmt& stmt) override;
+    void visitVarDeclStmt(VarDeclStmt& stmt) override;
+    void visitFuncDeclStmt(FuncDeclStmt& stmt) override;
+    void visitOptimizeStmt(OptimizeStmt& stmt) override;
+
+    void optimize(Script& script);
+};
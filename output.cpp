@@ -0,0 +1,414 @@
+#include "output.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+#include "builtins.h"
+
+void Output::measurement(const Measurement& measurement, int precision) {
+    if (m_muted) return;
+    writeMeasurement(measurement, precision);
+    if (m_buffer.size() >= FLUSH_SIZE) flush();
+}
+
+void Output::print(const std::vector<Value>& values) {
+    if (m_muted) return;
+    writePrint(values);
+    if (m_buffer.size() >= FLUSH_SIZE) flush();
+}
+
+void Output::history(const Recorder& recorder, int precision) {
+    if (m_muted) return;
+    writeHistory(recorder, precision);
+    if (m_buffer.size() >= FLUSH_SIZE) flush();
+}
+
+void Output::flush() {
+    if (m_fd < 0) return;
+    size_t written = 0;
+    while (written < m_buffer.size()) {
+        ssize_t count = write(m_fd, m_buffer.data() + written, m_buffer.size() - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            m_buffer.clear();
+            throw std::runtime_error(std::string("Error while writing output: ") + std::strerror(errno));
+        }
+        written += count;
+    }
+    m_buffer.clear();
+}
+
+std::optional<Output::Format> Output::findFormat(std::string_view name) {
+    if (name == "text") return Format::Text;
+    if (name == "binary") return Format::Binary;
+    if (name == "csv") return Format::CSV;
+    if (name == "ndjson") return Format::NDJSON;
+    return std::nullopt;
+}
+
+std::unique_ptr<Output> Output::create(Format format, int fd) {
+    switch (format) {
+        case Format::Text:
+            return std::make_unique<TextOutput>(fd);
+        case Format::Binary:
+            return std::make_unique<BinaryOutput>(fd);
+        case Format::CSV:
+            return std::make_unique<CSVOutput>(fd);
+        case Format::NDJSON:
+            return std::make_unique<NDJSONOutput>(fd);
+    }
+    return nullptr;
+}
+
+namespace {
+// Flushes what is left when the program exits.
+struct StandardOutput : public TextOutput {
+    StandardOutput() : TextOutput(STDOUT_FILENO) {}
+    ~StandardOutput() override {
+        try {
+            flush();
+        } catch (std::exception&) {
+        }
+    }
+};
+}  // namespace
+
+Output& Output::standard() {
+    static StandardOutput output;
+    return output;
+}
+
+static const char* label(Builtin builtin, bool hasOffset) {
+    switch (builtin) {
+        case Builtin::OutX:
+            return hasOffset ? "x" : "X";
+        case Builtin::OutZ:
+            return "z";
+        case Builtin::XMM:
+            return "x(mm)";
+        case Builtin::ZMM:
+            return "z(mm)";
+        case Builtin::XB:
+            return "x(b)";
+        case Builtin::ZB:
+            return "z(b)";
+        case Builtin::OutVX:
+            return "Vx";
+        case Builtin::OutVZ:
+            return "Vz";
+        default:
+            return "";
+    }
+}
+
+static const char* stateName(State state) {
+    switch (state) {
+        case State::JUMPING:
+            return "jumping";
+        case State::GROUNDED:
+            return "grounded";
+        case State::AIRBORNE:
+            return "airborne";
+    }
+    return "";
+}
+
+// The keys of a mask the way movements spell them, like "wa".
+static std::string keyNames(uint8_t keys) {
+    std::string names;
+    for (char key : {'w', 'a', 's', 'd'}) {
+        if (keys & keyMask(std::string_view(&key, 1))) names += key;
+    }
+    return names;
+}
+
+void TextOutput::writeMeasurement(const Measurement& measurement, int precision) {
+    m_stream << std::defaultfloat << label(measurement.builtin, measurement.offset.has_value()) << ": ";
+    if (measurement.offset.has_value()) {
+        std::visit([this](const auto& offset) { m_stream << offset; }, measurement.offset.value());
+        if (measurement.difference >= 0) {
+            m_stream << " - " << std::fixed << std::setprecision(precision) << measurement.difference;
+        } else {
+            m_stream << " + " << std::fixed << std::setprecision(precision) << -measurement.difference;
+        }
+    } else {
+        m_stream << std::fixed << std::setprecision(precision) << measurement.value;
+    }
+    m_stream << '\n';
+    m_buffer += m_stream.view();
+    m_stream.str({});
+}
+
+void TextOutput::writePrint(const std::vector<Value>& values) {
+    m_stream << std::defaultfloat;
+    for (auto& value : values) {
+        std::visit(overloaded{[this](auto value) { m_stream << value; },
+                              [this](bool value) { m_stream << std::boolalpha << value; },
+                              [this](const std::string& text) { m_stream << text.substr(1, text.size() - 2); }},
+                   value);
+    }
+    m_stream << '\n';
+    m_buffer += m_stream.view();
+    m_stream.str({});
+}
+
+void TextOutput::writeHistory(const Recorder& recorder, int precision) {
+    uint64_t number = recorder.recorded() - recorder.size();
+    for (size_t i = 0; i < recorder.size(); i++) {
+        Recorder::Tick tick = recorder[i];
+        m_stream << std::defaultfloat << "tick " << ++number << ": " << std::fixed << std::setprecision(precision)
+                 << "X: " << tick.x << " Z: " << tick.z << " Vx: " << tick.vx << " Vz: " << tick.vz << std::defaultfloat
+                 << " F: " << tick.rotation << ' ' << stateName(tick.state);
+        if (tick.keys != 0) m_stream << ' ' << keyNames(tick.keys);
+        m_stream << '\n';
+        m_buffer += m_stream.view();
+        m_stream.str({});
+    }
+}
+
+// Shortest text that reads back as the same number.
+template <typename T>
+static void appendNumber(std::string& out, T number) {
+    char text[32];
+    out.append(text, std::to_chars(text, text + sizeof(text), number).ptr);
+}
+
+static void appendNumber(std::string& out, const Value& number) {
+    std::visit(overloaded{[&out](int number) { appendNumber(out, number); },
+                          [&out](float number) { appendNumber(out, number); }, [](const auto&) {}},
+               number);
+}
+
+// What print shows for its values, without the trailing newline.
+static std::string printText(const std::vector<Value>& values) {
+    std::string text;
+    for (auto& value : values) {
+        std::visit(overloaded{[&text](int value) { appendNumber(text, value); },
+                              [&text](float value) { appendNumber(text, value); },
+                              [&text](bool value) { text += value ? "true" : "false"; },
+                              [&text](const std::string& value) { text += value.substr(1, value.size() - 2); }},
+                   value);
+    }
+    return text;
+}
+
+template <typename T>
+static void appendRaw(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+void BinaryOutput::writeMeasurement(const Measurement& measurement, int) {
+    uint8_t flags = 0;
+    double offset = 0.0;
+    if (measurement.offset.has_value()) {
+        flags |= HAS_OFFSET;
+        if (const int* integer = std::get_if<int>(&measurement.offset.value())) {
+            flags |= INTEGER_OFFSET;
+            offset = *integer;
+        } else {
+            offset = std::get<float>(measurement.offset.value());
+        }
+    }
+    appendRaw(m_buffer, static_cast<uint8_t>(measurement.builtin));
+    appendRaw(m_buffer, flags);
+    appendRaw(m_buffer, uint16_t{0});
+    appendRaw(m_buffer, uint32_t{0});
+    appendRaw(m_buffer, measurement.value);
+    appendRaw(m_buffer, offset);
+    appendRaw(m_buffer, measurement.difference);
+}
+
+void BinaryOutput::writePrint(const std::vector<Value>& values) {
+    std::string text = printText(values);
+    appendRaw(m_buffer, static_cast<uint8_t>(Builtin::Print));
+    appendRaw(m_buffer, uint8_t{0});
+    appendRaw(m_buffer, uint16_t{0});
+    appendRaw(m_buffer, static_cast<uint32_t>(text.size()));
+    m_buffer += text;
+}
+
+// A column of the recorder, oldest tick first.
+template <typename T>
+static void appendColumn(std::string& out, const Recorder& recorder, const std::vector<T>& column) {
+    size_t first = recorder.first(), head = std::min(recorder.size(), recorder.capacity() - first);
+    out.append(reinterpret_cast<const char*>(column.data() + first), head * sizeof(T));
+    out.append(reinterpret_cast<const char*>(column.data()), (recorder.size() - head) * sizeof(T));
+}
+
+void BinaryOutput::writeHistory(const Recorder& recorder, int) {
+    appendRaw(m_buffer, static_cast<uint8_t>(Builtin::History));
+    appendRaw(m_buffer, uint8_t{0});
+    appendRaw(m_buffer, uint16_t{0});
+    appendRaw(m_buffer, static_cast<uint32_t>(recorder.size()));
+    appendRaw(m_buffer, static_cast<uint64_t>(recorder.recorded() - recorder.size() + 1));
+    appendColumn(m_buffer, recorder, recorder.positionX);
+    appendColumn(m_buffer, recorder, recorder.positionZ);
+    appendColumn(m_buffer, recorder, recorder.velocityX);
+    appendColumn(m_buffer, recorder, recorder.velocityZ);
+    appendColumn(m_buffer, recorder, recorder.rotation);
+    appendColumn(m_buffer, recorder, recorder.state);
+    appendColumn(m_buffer, recorder, recorder.keys);
+}
+
+CSVOutput::CSVOutput(int fd) : Output(fd) { m_buffer += "builtin,value,offset,difference,text\n"; }
+
+void CSVOutput::writeMeasurement(const Measurement& measurement, int) {
+    m_buffer += builtinName(measurement.builtin);
+    m_buffer += ',';
+    appendNumber(m_buffer, measurement.value);
+    m_buffer += ',';
+    if (measurement.offset.has_value()) {
+        appendNumber(m_buffer, measurement.offset.value());
+        m_buffer += ',';
+        appendNumber(m_buffer, measurement.difference);
+    } else {
+        m_buffer += ',';
+    }
+    m_buffer += ",\n";
+}
+
+void CSVOutput::writePrint(const std::vector<Value>& values) {
+    std::string text = printText(values);
+    m_buffer += "print,,,,";
+    if (text.find_first_of(",\"\r\n") == std::string::npos) {
+        m_buffer += text;
+    } else {
+        m_buffer += '"';
+        for (char c : text) {
+            if (c == '"') m_buffer += '"';
+            m_buffer += c;
+        }
+        m_buffer += '"';
+    }
+    m_buffer += '\n';
+}
+
+void CSVOutput::writeHistory(const Recorder& recorder, int) {
+    uint64_t number = recorder.recorded() - recorder.size();
+    for (size_t i = 0; i < recorder.size(); i++) {
+        Recorder::Tick tick = recorder[i];
+        m_buffer += "history,,,,";
+        appendNumber(m_buffer, ++number);
+        for (double value : {tick.x, tick.z, tick.vx, tick.vz}) {
+            m_buffer += ' ';
+            appendNumber(m_buffer, value);
+        }
+        m_buffer += ' ';
+        appendNumber(m_buffer, tick.rotation);
+        m_buffer += ' ';
+        m_buffer += stateName(tick.state);
+        m_buffer += ' ';
+        m_buffer += keyNames(tick.keys);
+        m_buffer += '\n';
+    }
+}
+
+// JSON has no infinities or NaN, they become null.
+template <typename T>
+static void appendJSONNumber(std::string& out, T number) {
+    if (std::isfinite(number)) {
+        appendNumber(out, number);
+    } else {
+        out += "null";
+    }
+}
+
+static void appendJSONString(std::string& out, std::string_view text) {
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+void NDJSONOutput::writeMeasurement(const Measurement& measurement, int) {
+    m_buffer += "{\"builtin\":\"";
+    m_buffer += builtinName(measurement.builtin);
+    m_buffer += "\",\"value\":";
+    appendJSONNumber(m_buffer, measurement.value);
+    if (measurement.offset.has_value()) {
+        m_buffer += ",\"offset\":";
+        if (const int* integer = std::get_if<int>(&measurement.offset.value())) {
+            appendNumber(m_buffer, *integer);
+        } else {
+            appendJSONNumber(m_buffer, std::get<float>(measurement.offset.value()));
+        }
+        m_buffer += ",\"difference\":";
+        appendJSONNumber(m_buffer, measurement.difference);
+    }
+    m_buffer += "}\n";
+}
+
+void NDJSONOutput::writePrint(const std::vector<Value>& values) {
+    m_buffer += "{\"builtin\":\"print\",\"values\":[";
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i > 0) m_buffer += ',';
+        std::visit(overloaded{[this](int value) { appendNumber(m_buffer, value); },
+                              [this](float value) { appendJSONNumber(m_buffer, value); },
+                              [this](bool value) { m_buffer += value ? "true" : "false"; },
+                              [this](const std::string& value) {
+                                  appendJSONString(m_buffer, std::string_view(value).substr(1, value.size() - 2));
+                              }},
+                   values[i]);
+    }
+    m_buffer += "]}\n";
+}
+
+void NDJSONOutput::writeHistory(const Recorder& recorder, int) {
+    uint64_t number = recorder.recorded() - recorder.size();
+    for (size_t i = 0; i < recorder.size(); i++) {
+        Recorder::Tick tick = recorder[i];
+        m_buffer += "{\"builtin\":\"history\",\"tick\":";
+        appendNumber(m_buffer, ++number);
+        m_buffer += ",\"x\":";
+        appendJSONNumber(m_buffer, tick.x);
+        m_buffer += ",\"z\":";
+        appendJSONNumber(m_buffer, tick.z);
+        m_buffer += ",\"vx\":";
+        appendJSONNumber(m_buffer, tick.vx);
+        m_buffer += ",\"vz\":";
+        appendJSONNumber(m_buffer, tick.vz);
+        m_buffer += ",\"facing\":";
+        appendJSONNumber(m_buffer, tick.rotation);
+        m_buffer += ",\"state\":\"";
+        m_buffer += stateName(tick.state);
+        m_buffer += "\",\"keys\":\"";
+        m_buffer += keyNames(tick.keys);
+        m_buffer += "\"}\n";
+    }
+}
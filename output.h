@@ -0,0 +1,124 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "parser.h"
+#include "recorder.h"
+
+// Where the output builtins write. Everything is buffered and written out by flush(), which the interpreters call
+// before they report an error and the flush builtin and the end of the script call. It also happens by itself once
+// FLUSH_SIZE bytes have piled up, so long scripts don't hold all of their output. An output on fd -1 writes nothing
+// out and keeps it all for take() instead.
+class Output {
+   public:
+    enum class Format { Text, Binary, CSV, NDJSON };
+    // What one of outx, outz, xmm, zmm, xb, zb, outvx and outvz measured. With an argument, `offset` is it and
+    // `difference` is offset - value, computed in the types the builtin compares them in.
+    struct Measurement {
+        Builtin builtin;
+        double value = 0.0;
+        std::optional<Value> offset;
+        double difference = 0.0;
+    };
+
+   protected:
+    static constexpr size_t FLUSH_SIZE = 64 * 1024;
+    std::string m_buffer;
+
+   private:
+    int m_fd;
+    bool m_muted = false;
+
+   private:
+    virtual void writeMeasurement(const Measurement& measurement, int precision) = 0;
+    virtual void writePrint(const std::vector<Value>& values) = 0;
+    virtual void writeHistory(const Recorder& recorder, int precision) = 0;
+
+   public:
+    explicit Output(int fd) : m_fd(fd) {}
+    virtual ~Output() = default;
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    // `precision` is the number of decimals the text format shows.
+    void measurement(const Measurement& measurement, int precision);
+    void print(const std::vector<Value>& values);
+    // Every tick the recorder holds, oldest first.
+    void history(const Recorder& recorder, int precision);
+    void flush();
+    // What was written and not flushed yet, and empties the buffer.
+    std::string take() { return std::exchange(m_buffer, {}); }
+    // While muted everything written is dropped. The tree-walker mutes its output during optimize searches.
+    void mute(bool muted) { m_muted = muted; }
+    bool muted() const { return m_muted; }
+
+    static std::optional<Format> findFormat(std::string_view name);
+    static std::unique_ptr<Output> create(Format format, int fd);
+    // Text on standard output, written out at exit. What the interpreters use unless they are given another.
+    static Output& standard();
+};
+
+// The format sim has always printed, for people.
+class TextOutput : public Output {
+   private:
+    // Keeps its flags between records, a measurement leaves its precision behind for the plain numbers that follow.
+    std::ostringstream m_stream;
+
+   private:
+    void writeMeasurement(const Measurement& measurement, int precision) override;
+    void writePrint(const std::vector<Value>& values) override;
+    void writeHistory(const Recorder& recorder, int precision) override;
+
+   public:
+    using Output::Output;
+};
+
+// Fixed size little endian records that can be read straight into a struct:
+//   u8 builtin, u8 flags (HAS_OFFSET, INTEGER_OFFSET), u16 zero, u32 zero, f64 value, f64 offset, f64 difference
+// print writes u8 Builtin::Print, u8 zero, u16 zero, u32 length, then `length` bytes of the text it prints.
+// history writes u8 Builtin::History, u8 zero, u16 zero, u32 count, u64 number of the first tick, then the columns of
+// the ticks one after the other: f64 x, f64 z, f64 vx, f64 vz, f32 facing, u8 state (State), u8 keys (Key bits).
+class BinaryOutput : public Output {
+   public:
+    static constexpr uint8_t HAS_OFFSET = 1, INTEGER_OFFSET = 2;
+
+   private:
+    void writeMeasurement(const Measurement& measurement, int precision) override;
+    void writePrint(const std::vector<Value>& values) override;
+    void writeHistory(const Recorder& recorder, int precision) override;
+
+   public:
+    using Output::Output;
+};
+
+// One row per record under a "builtin,value,offset,difference,text" header, numbers in shortest round trip form.
+// history writes a row per tick, its text is "tick x z vx vz facing state keys".
+class CSVOutput : public Output {
+   private:
+    void writeMeasurement(const Measurement& measurement, int precision) override;
+    void writePrint(const std::vector<Value>& values) override;
+    void writeHistory(const Recorder& recorder, int precision) override;
+
+   public:
+    explicit CSVOutput(int fd);
+};
+
+// One JSON object per line, {"builtin":"outx","value":...} with "offset" and "difference" when there is an argument,
+// {"builtin":"print","values":[...]} for print and
+// {"builtin":"history","tick":1,"x":...,"z":...,"vx":...,"vz":...,"facing":...,"state":"airborne","keys":"wa"} for
+// every tick history writes.
+class NDJSONOutput : public Output {
+   private:
+    void writeMeasurement(const Measurement& measurement, int precision) override;
+    void writePrint(const std::vector<Value>& values) override;
+    void writeHistory(const Recorder& recorder, int precision) override;
+
+   public:
+    using Output::Output;
+};
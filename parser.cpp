@@ -1,13 +1,23 @@
 #include "parser.h"
 
 #include <exception>
-#include <iomanip>
 #include <iostream>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <variant>
 
+#include "builtins.h"
+#include "search.h"
+
+std::optional<Field> findField(std::string_view identifier) {
+    if (identifier == "x") return Field::X;
+    if (identifier == "z") return Field::Z;
+    if (identifier == "vx") return Field::VX;
+    if (identifier == "vz") return Field::VZ;
+    return std::nullopt;
+}
+
 void BlockStmt::accept(struct StmtVisitor& visitor) { visitor.visitBlockStmt(*this); }
 void ExprStmt::accept(struct StmtVisitor& visitor) { visitor.visitExprStmt(*this); }
 void IfStmt::accept(struct StmtVisitor& visitor) { visitor.visitIfStmt(*this); }
@@ -15,6 +25,7 @@ void ForStmt::accept(struct StmtVisitor& visitor) { visitor.visitForStmt(*this);
 void WhileStmt::accept(struct StmtVisitor& visitor) { visitor.visitWhileStmt(*this); }
 void VarDeclStmt::accept(struct StmtVisitor& visitor) { visitor.visitVarDeclStmt(*this); }
 void FuncDeclStmt::accept(struct StmtVisitor& visitor) { visitor.visitFuncDeclStmt(*this); }
+void OptimizeStmt::accept(struct StmtVisitor& visitor) { visitor.visitOptimizeStmt(*this); }
 OptionalValue LiteralExpr::accept(struct ExprVisitor& visitor) { return visitor.visitLiteralExpr(*this); }
 OptionalValue VarExpr::accept(struct ExprVisitor& visitor) { return visitor.visitVarExpr(*this); }
 OptionalValue AssignExpr::accept(struct ExprVisitor& visitor) { return visitor.visitAssignExpr(*this); }
@@ -22,26 +33,187 @@ OptionalValue UnaryExpr::accept(struct ExprVisitor& visitor) { return visitor.vi
 OptionalValue BinaryExpr::accept(struct ExprVisitor& visitor) { return visitor.visitBinaryExpr(*this); }
 OptionalValue CallExpr::accept(struct ExprVisitor& visitor) { return visitor.visitCallExpr(*this); }
 
-template <typename... Ts>
-struct overloaded : Ts... {
-    using Ts::operator()...;
-};
-template <typename... Ts>
-overloaded(Ts...) -> overloaded<Ts...>;
+LiteralExpr::LiteralExpr(Type type, std::string_view value) : type(type), value(value) {
+    try {
+        switch (type) {
+            case Type::Integer:
+                integer = std::stoi(std::string(value));
+                break;
+            case Type::Float:
+                floating = std::stof(std::string(value));
+                break;
+            case Type::Boolean:
+                boolean = value == "true";
+                break;
+            case Type::String:
+                break;
+        }
+    } catch (std::exception&) {
+        valid = false;
+    }
+}
+
+Value LiteralExpr::evaluate() const {
+    switch (type) {
+        case Type::Integer:
+            return valid ? integer : std::stoi(std::string(value));
+        case Type::Float:
+            return valid ? floating : std::stof(std::string(value));
+        case Type::Boolean:
+            return boolean;
+        case Type::String:
+            break;
+    }
+    return std::string(value);
+}
+
+StaticType LiteralExpr::staticType() const {
+    switch (type) {
+        case Type::Integer:
+            return StaticType::Integer;
+        case Type::Float:
+            return StaticType::Float;
+        case Type::Boolean:
+            return StaticType::Boolean;
+        case Type::String:
+            break;
+    }
+    return StaticType::String;
+}
+
+template <typename T>
+T checkRhs(T rhs) {
+    if (rhs == 0) {
+        throw std::runtime_error("Can not divide by zero");
+    }
+    return rhs;
+}
+
+// Every numeric operator, for the operand types the language mixes freely. And and Or take no numbers.
+template <typename L, typename R>
+static OptionalValue numeric(Operator op, L lhs, R rhs) {
+    switch (op) {
+        case Operator::Add:
+            return lhs + rhs;
+        case Operator::Subtract:
+            return lhs - rhs;
+        case Operator::Multiply:
+            return lhs * rhs;
+        case Operator::Divide:
+            return lhs / checkRhs(rhs);
+        case Operator::LessThan:
+            return lhs < rhs;
+        case Operator::GreaterThan:
+            return lhs > rhs;
+        case Operator::LessThanOrEquals:
+            return lhs <= rhs;
+        case Operator::GreaterThanOrEquals:
+            return lhs >= rhs;
+        case Operator::Equals:
+            return lhs == rhs;
+        case Operator::NotEquals:
+            return lhs != rhs;
+        case Operator::And:
+        case Operator::Or:
+            break;
+    }
+    throw std::runtime_error(op == Operator::And ? "Invalid operands for and" : "Invalid operands for or");
+}
+
+OptionalValue evaluateUnary(Operator op, const Value& operand) {
+    if (const int* value = std::get_if<int>(&operand)) return op == Operator::Subtract ? -*value : *value;
+    if (const float* value = std::get_if<float>(&operand)) return op == Operator::Subtract ? -*value : *value;
+    throw std::runtime_error(op == Operator::Subtract ? "Invalid operands for unary minus"
+                                                      : "Invalid operands for unary plus");
+}
+
+OptionalValue evaluateBinary(Operator op, const Value& lhs, const Value& rhs) {
+    static constexpr const char* errors[] = {
+        "Invalid operands for add",
+        "Invalid operands for add",
+        "Invalid operands for add",
+        "Invalid operands for add",
+        "Invalid operands for less than",
+        "Invalid operands for greater than",
+        "Invalid operands for less than or equals",
+        "Invalid operands for greater than or equals",
+        "Invalid operands for equals",
+        "Invalid operands for not equals",
+        "Invalid operands for and",
+        "Invalid operands for or",
+    };
+    return std::visit(
+        overloaded{[op](int lhs, int rhs) { return numeric(op, lhs, rhs); },
+                   [op](float lhs, float rhs) { return numeric(op, lhs, rhs); },
+                   [op](int lhs, float rhs) { return numeric(op, lhs, rhs); },
+                   [op](float lhs, int rhs) { return numeric(op, lhs, rhs); },
+                   [op](bool lhs, bool rhs) -> OptionalValue {
+                       if (op == Operator::And) return lhs && rhs;
+                       if (op == Operator::Or) return lhs || rhs;
+                       if (op == Operator::Equals) return lhs == rhs;
+                       if (op == Operator::NotEquals) return lhs != rhs;
+                       throw std::runtime_error(errors[static_cast<size_t>(op)]);
+                   },
+                   [op](const std::string& lhs, const std::string& rhs) -> OptionalValue {
+                       if (op == Operator::Equals) return lhs == rhs;
+                       if (op == Operator::NotEquals) return lhs != rhs;
+                       throw std::runtime_error(errors[static_cast<size_t>(op)]);
+                   },
+                   [op](const auto&, const auto&) -> OptionalValue {
+                       throw std::runtime_error(errors[static_cast<size_t>(op)]);
+                   }},
+        lhs, rhs);
+}
+
+CodeVisitor::CodeVisitor() : m_output(&Output::standard()) {}
+
+void CodeVisitor::bind(uint32_t slot, OptionalValue value) {
+    if (slot >= m_variables.bindings.size()) m_variables.bindings.resize(slot + 1);
+    m_variables.bindings[slot].push_back(std::move(value));
+    m_variables.bound.push_back(slot);
+}
+
+// Drops the innermost bindings until `count` are left.
+void CodeVisitor::unbind(size_t count) {
+    while (m_variables.bound.size() > count) {
+        m_variables.bindings[m_variables.bound.back()].pop_back();
+        m_variables.bound.pop_back();
+    }
+}
+
+OptionalValue* CodeVisitor::lookup(uint32_t slot) {
+    if (slot >= m_variables.bindings.size() || m_variables.bindings[slot].empty()) return nullptr;
+    return &m_variables.bindings[slot].back();
+}
+
+double& CodeVisitor::field(Field field) {
+    switch (field) {
+        case Field::X:
+            return m_player.position.x;
+        case Field::Z:
+            return m_player.position.z;
+        case Field::VX:
+            return m_player.velocity.x;
+        default:
+            return m_player.velocity.z;
+    }
+}
+
 void CodeVisitor::visitExprStmt(ExprStmt& stmt) { stmt.expression->accept(*this); }
 void CodeVisitor::visitBlockStmt(BlockStmt& stmt) {
-    size_t variablesSize = m_variables.size();
+    size_t variablesSize = m_variables.bound.size();
     bool prevTap = m_tap;
     m_tap = stmt.tap;
     for (const auto& it : stmt.statements) {
         try {
-            it.get()->accept(*this);
+            it->accept(*this);
         } catch (std::exception& e) {
-            std::cerr << "\033[31m" << "ERROR: " << e.what() << "\033[0m" << std::endl;
+            m_output->flush();
+            if (m_errors) *m_errors << "\033[31m" << "ERROR: " << e.what() << "\033[0m" << std::endl;
         }
     }
     m_tap = prevTap;
-    m_variables.resize(variablesSize);
+    unbind(variablesSize);
 }
 void CodeVisitor::visitIfStmt(IfStmt& stmt) {
     bool condition = std::visit(overloaded{[](bool condition) { return condition; },
@@ -80,69 +252,92 @@ void CodeVisitor::visitWhileStmt(WhileStmt& stmt) {
     }
 };
 void CodeVisitor::visitVarDeclStmt(VarDeclStmt& stmt) {
-    m_variables.push_back(Var{stmt.identifier, stmt.value->accept(*this)});
+    OptionalValue value = stmt.value->accept(*this);
+    bind(stmt.slot, std::move(value));
 }
-void CodeVisitor::visitFuncDeclStmt(FuncDeclStmt& stmt) { m_functions.push_back(std::move(stmt)); };
+void CodeVisitor::visitFuncDeclStmt(FuncDeclStmt& stmt) {
+    if (stmt.slot >= m_functions.size()) m_functions.resize(stmt.slot + 1);
+    if (!m_functions[stmt.slot]) m_functions[stmt.slot] = &stmt;
+};
+void CodeVisitor::visitOptimizeStmt(OptimizeStmt& stmt) {
+    std::vector<SearchRange> ranges;
+    for (auto& parameter : stmt.parameters) {
+        Value from = parameter.from->accept(*this).value();
+        Value to = parameter.to->accept(*this).value();
+        Value step = parameter.step->accept(*this).value();
+        ranges.push_back(makeSearchRange(from, to, step));
+    }
+    size_t count = countCandidates(ranges);
 
-bool stringCheck(std::string& str, std::string sub) {
-    if (str.starts_with(sub)) {
-        str = str.substr(sub.length());
-        return true;
-    }
-    return false;
-}
-OptionalValue CodeVisitor::visitLiteralExpr(LiteralExpr& expr) {
-    switch (expr.type) {
-        case LiteralExpr::Type::String:
-            return expr.value;
-        case LiteralExpr::Type::Boolean:
-            return expr.value == "true";
-        case LiteralExpr::Type::Integer:
-            return std::stoi(expr.value);
-        case LiteralExpr::Type::Float:
-            return std::stof(expr.value);
+    // Runs the body like a function call taking the parameters, the objective is evaluated in the same scope.
+    auto run = [this, &stmt, &ranges](size_t index) {
+        size_t variablesSize = m_variables.bound.size();
+        std::vector<Value> values = candidateValues(ranges, index);
+        for (size_t i = 0; i < values.size(); i++) bind(stmt.parameters[i].slot, values[i]);
+        stmt.body->accept(*this);
+        Value objective = stmt.objective->accept(*this).value();
+        unbind(variablesSize);
+        return objective;
+    };
+
+    // The candidates aren't recorded, only the run of the best one.
+    Recorder* recorder = m_player.recorder;
+    m_player.recorder = nullptr;
+    Player player = m_player;
+    Variables variables = m_variables;
+    Snapshots snapshots = m_snapshots;
+    bool muted = m_output->muted();
+    m_output->mute(true);
+    std::ostream* errors = std::exchange(m_errors, nullptr);
+    std::optional<size_t> best;
+    // A straight run of movements is searched as a tree of shared prefixes instead, see search.h.
+    std::optional<SearchPlan> plan;
+    if (!m_tap) {
+        plan = planSearch(stmt, [this](const CallExpr& call) {
+            return call.slot < m_functions.size() && m_functions[call.slot] != nullptr;
+        });
+    }
+    if (plan.has_value()) {
+        best = search(plan.value(), m_player, ranges, true);
+    } else {
+        double bestScore = 0.0;
+        for (size_t index = 0; index < count; index++) {
+            std::optional<double> score;
+            try {
+                score = scoreObjective(stmt.goal, run(index));
+            } catch (std::exception&) {
+            }
+            m_player = player;
+            m_variables = variables;
+            m_snapshots = snapshots;
+            if (score.has_value() && (!best.has_value() || score.value() > bestScore)) {
+                best = index;
+                bestScore = score.value();
+                if (stmt.goal == OptimizeStmt::Goal::Until) break;
+            }
+        }
     }
-    return std::nullopt;
+    m_output->mute(muted);
+    m_errors = errors;
+    m_player.recorder = recorder;
+
+    if (!best.has_value()) throw std::runtime_error("No candidate found for optimize");
+    run(best.value());
 }
 
+OptionalValue CodeVisitor::visitLiteralExpr(LiteralExpr& expr) { return expr.evaluate(); }
+
 OptionalValue CodeVisitor::visitVarExpr(VarExpr& expr) {
-    if (expr.identifier == "x") {
-        return static_cast<float>(m_player.position.x);
-    }
-    if (expr.identifier == "z") {
-        return static_cast<float>(m_player.position.z);
-    }
-    if (expr.identifier == "vx") {
-        return static_cast<float>(m_player.velocity.x);
-    }
-    if (expr.identifier == "vz") {
-        return static_cast<float>(m_player.velocity.z);
-    }
-    for (int i = m_variables.size() - 1; i >= 0; i--) {
-        if (m_variables[i].identifier == expr.identifier) {
-            return m_variables[i].value;
-        }
-    }
+    if (expr.field.has_value()) return static_cast<float>(field(expr.field.value()));
+    if (OptionalValue* value = lookup(expr.slot)) return *value;
     throw std::runtime_error("Variable not recognized");
     return std::nullopt;
 }
 
 OptionalValue CodeVisitor::visitAssignExpr(AssignExpr& expr) {
-    double* ref = nullptr;
-    if (expr.identifier == "x") {
-        ref = &m_player.position.x;
-    }
-    if (expr.identifier == "z") {
-        ref = &m_player.position.z;
-    }
-    if (expr.identifier == "vx") {
-        ref = &m_player.velocity.x;
-    }
-    if (expr.identifier == "vz") {
-        ref = &m_player.velocity.z;
-    }
-    if (ref != nullptr) {
-        return static_cast<float>(*ref =
+    if (expr.field.has_value()) {
+        double& ref = field(expr.field.value());
+        return static_cast<float>(ref =
                                       std::visit(overloaded{[](float value) { return value; },
                                                             [](int value) { return static_cast<float>(value); },
                                                             [](auto) {
@@ -151,512 +346,98 @@ OptionalValue CodeVisitor::visitAssignExpr(AssignExpr& expr) {
                                                             }},
                                                  expr.value->accept(*this).value()));
     }
-    for (int i = m_variables.size() - 1; i >= 0; i--) {
-        if (m_variables[i].identifier == expr.identifier) {
-            return m_variables[i].value = expr.value->accept(*this).value();
-        }
-    }
-    throw std::runtime_error("Undefined variable");
-    return std::nullopt;
+    if (!lookup(expr.slot)) throw std::runtime_error("Undefined variable");
+    // Evaluating the value leaves the bindings as they were, but may move them.
+    Value value = expr.value->accept(*this).value();
+    return *lookup(expr.slot) = value;
 }
 
-template <typename T>
-T checkRhs(T rhs) {
-    if (rhs == 0) {
-        throw std::runtime_error("Can not divide by zero");
-    }
-    return rhs;
-}
 OptionalValue CodeVisitor::visitUnaryExpr(UnaryExpr& expr) {
-    switch (expr.operation[0]) {
-        case '-': {
-            return std::visit(
-                overloaded{[](int lhs) -> OptionalValue { return -lhs; },
-                           [](float lhs) -> OptionalValue { return -lhs; },
-                           [](auto) -> OptionalValue { throw std::runtime_error("Invalid operands for unary minus"); }},
-                expr.operand->accept(*this).value());
+    switch (expr.operands) {
+        case StaticType::Integer: {
+            int operand = std::get<int>(expr.operand->accept(*this).value());
+            return expr.op == Operator::Subtract ? -operand : operand;
         }
-        case '+': {
-            return std::visit(
-                overloaded{[](int lhs) -> OptionalValue { return lhs; }, [](float lhs) -> OptionalValue { return lhs; },
-                           [](auto) -> OptionalValue { throw std::runtime_error("Invalid operands for unary plus"); }},
-                expr.operand->accept(*this).value());
+        case StaticType::Float: {
+            float operand = std::get<float>(expr.operand->accept(*this).value());
+            return expr.op == Operator::Subtract ? -operand : operand;
         }
+        default:
+            return evaluateUnary(expr.op, expr.operand->accept(*this).value());
     }
-    return std::nullopt;
 }
 
+// The right operand is evaluated first. Operands the Optimizer has typed skip the dispatch on their types.
 OptionalValue CodeVisitor::visitBinaryExpr(BinaryExpr& expr) {
-    if (expr.operation == "+") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs + rhs; },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs + rhs; },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs + rhs; },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs + rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for add"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "-") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs - rhs; },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs - rhs; },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs - rhs; },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs - rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for add"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "*") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs * rhs; },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs * rhs; },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs * rhs; },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs * rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for add"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "/") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs / checkRhs(rhs); },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs / checkRhs(rhs); },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs / checkRhs(rhs); },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs / checkRhs(rhs); },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for add"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "<") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs < rhs; },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs < rhs; },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs < rhs; },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs < rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for less than"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == ">") {
-        return std::visit(overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs > rhs; },
-                                     [](float lhs, float rhs) -> OptionalValue { return lhs > rhs; },
-                                     [](int lhs, float rhs) -> OptionalValue { return lhs > rhs; },
-                                     [](float lhs, int rhs) -> OptionalValue { return lhs > rhs; },
-                                     [](auto, auto) -> OptionalValue {
-                                         throw std::runtime_error("Invalid operands for greater than");
-                                     }},
-                          expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "==") {
-        return std::visit(
-            overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs == rhs; },
-                       [](float lhs, float rhs) -> OptionalValue { return lhs == rhs; },
-                       [](int lhs, float rhs) -> OptionalValue { return lhs == rhs; },
-                       [](float lhs, int rhs) -> OptionalValue { return lhs == rhs; },
-                       [](bool lhs, bool rhs) -> OptionalValue { return lhs == rhs; },
-                       [](std::string lhs, std::string rhs) -> OptionalValue { return lhs == rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for equals"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "!=") {
-        return std::visit(overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](float lhs, float rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](int lhs, float rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](float lhs, int rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](bool lhs, bool rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](std::string lhs, std::string rhs) -> OptionalValue { return lhs != rhs; },
-                                     [](auto, auto) -> OptionalValue {
-                                         throw std::runtime_error("Invalid operands for not equals");
-                                     }},
-                          expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == ">=") {
-        return std::visit(overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs >= rhs; },
-                                     [](float lhs, float rhs) -> OptionalValue { return lhs >= rhs; },
-                                     [](int lhs, float rhs) -> OptionalValue { return lhs >= rhs; },
-                                     [](float lhs, int rhs) -> OptionalValue { return lhs >= rhs; },
-                                     [](auto, auto) -> OptionalValue {
-                                         throw std::runtime_error("Invalid operands for greater than or equals");
-                                     }},
-                          expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "<=") {
-        return std::visit(overloaded{[](int lhs, int rhs) -> OptionalValue { return lhs <= rhs; },
-                                     [](float lhs, float rhs) -> OptionalValue { return lhs <= rhs; },
-                                     [](int lhs, float rhs) -> OptionalValue { return lhs <= rhs; },
-                                     [](float lhs, int rhs) -> OptionalValue { return lhs <= rhs; },
-                                     [](auto, auto) -> OptionalValue {
-                                         throw std::runtime_error("Invalid operands for less than or equals");
-                                     }},
-                          expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "&&") {
-        // TODO: Short circuit if first operand is false
-        return std::visit(
-            overloaded{[](bool lhs, bool rhs) -> OptionalValue { return lhs && rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for and"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    } else if (expr.operation == "||") {
-        // TODO: Short circuit if first operand is true
-        return std::visit(
-            overloaded{[](bool lhs, bool rhs) -> OptionalValue { return lhs || rhs; },
-                       [](auto, auto) -> OptionalValue { throw std::runtime_error("Invalid operands for or"); }},
-            expr.lhs->accept(*this).value(), expr.rhs->accept(*this).value());
-    }
-
-    return std::nullopt;
-}
-
-OptionalValue CodeVisitor::visitCallExpr(CallExpr& expr) {
-    std::string identifier{expr.identifier};
-
-    for (auto& func : m_functions) {
-        if (func.identifier == identifier) {
-            size_t variablesSize = m_variables.size();
-            if (expr.arguments.size() < func.parameters.size()) throw std::runtime_error("Not enough arguments");
-            for (size_t i = 0; i < func.parameters.size(); i++)
-                m_variables.push_back(Var(func.parameters[i], expr.arguments[i]->accept(*this).value()));
-            func.body->accept(*this);
-            m_variables.resize(variablesSize);
-            return std::nullopt;
+    switch (expr.operands) {
+        case StaticType::Integer: {
+            int rhs = std::get<int>(expr.rhs->accept(*this).value());
+            return numeric(expr.op, std::get<int>(expr.lhs->accept(*this).value()), rhs);
         }
-    }
-    if (identifier == "|") {
-        m_player.position.x = 0.0f;
-        m_player.position.z = 0.0f;
-        return std::nullopt;
-    }
-
-    std::cout << std::defaultfloat;
-    std::vector<Value> args;
-    for (auto& arg : expr.arguments) {
-        if (auto result = arg->accept(*this); result.has_value()) {
-            args.push_back(result.value());
-        } else {
-            throw std::runtime_error("Error invalid argument");
+        case StaticType::Float: {
+            float rhs = std::get<float>(expr.rhs->accept(*this).value());
+            return numeric(expr.op, std::get<float>(expr.lhs->accept(*this).value()), rhs);
         }
-    }
-
-    if (identifier == "facing" || identifier == "f") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](int val) { m_player.face(static_cast<float>(val)); },
-                                  [this](float val) { m_player.face(val); },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            m_player.face(0.0f);
-        }
-        return std::nullopt;
-    }
-    if (identifier == "outx") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](auto offset) {
-                                      if (offset >= m_player.position.x) {
-                                          std::cout << "x: " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << offset - m_player.position.x << std::endl;
-                                      } else {
-                                          std::cout << "x: " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << m_player.position.x - offset << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "X: " << std::fixed << std::setprecision(m_player.precision) << m_player.position.x
-                      << std::endl;
+        default: {
+            Value rhs = expr.rhs->accept(*this).value();
+            return evaluateBinary(expr.op, expr.lhs->accept(*this).value(), rhs);
         }
-        return std::nullopt;
-    }
-    if (identifier == "outz") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](auto offset) {
-                                      if (offset >= m_player.position.z) {
-                                          std::cout << "z: " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << offset - m_player.position.z << std::endl;
-                                      } else {
-                                          std::cout << "z: " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << m_player.position.z - offset << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "z: " << std::fixed << std::setprecision(m_player.precision) << m_player.position.z
-                      << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "xmm") {
-        float pos = m_player.position.x;
-        if (pos >= 0.6f) {
-            pos -= 0.6f;
-        } else if (pos <= -0.6f) {
-            pos += 0.6f;
-        } else {
-            pos = 0.0f;
-        }
-        if (args.size() > 0) {
-            std::visit(overloaded{[this, &pos](auto offset) {
-                                      if (offset >= pos) {
-                                          std::cout << "x(mm): " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision) << offset - pos
-                                                    << std::endl;
-                                      } else {
-                                          std::cout << "x(mm): " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision) << pos - offset
-                                                    << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "x(mm): " << std::fixed << std::setprecision(m_player.precision) << pos << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "zmm") {
-        float pos = m_player.position.z;
-        if (pos >= 0.6f) {
-            pos -= 0.6f;
-        } else if (pos <= -0.6f) {
-            pos += 0.6f;
-        } else {
-            pos = 0.0f;
-        }
-        if (args.size() > 0) {
-            std::visit(overloaded{[this, &pos](auto offset) {
-                                      if (offset >= pos) {
-                                          std::cout << "z(mm): " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision) << offset - pos
-                                                    << std::endl;
-                                      } else {
-                                          std::cout << "z(mm): " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision) << pos - offset
-                                                    << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "z(mm): " << std::fixed << std::setprecision(m_player.precision) << pos << std::endl;
-        }
-        return std::nullopt;
     }
-    if (identifier == "xb") {
-        float pos = m_player.position.x;
-        if (pos >= 0.0f) {
-            pos += 0.6f;
-        } else {
-            pos -= 0.6f;
-        }
-        if (args.size() > 0) {
-            std::visit(overloaded{[this, &pos](auto offset) {
-                                      if (offset >= pos) {
-                                          std::cout << "x(b): " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision) << offset - pos
-                                                    << std::endl;
-                                      } else {
-                                          std::cout << "x(b): " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision) << pos - offset
-                                                    << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "x(b): " << std::fixed << std::setprecision(m_player.precision) << pos << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "zb") {
-        float pos = m_player.position.z;
-        if (pos >= 0.0f) {
-            pos += 0.6f;
-        } else {
-            pos -= 0.6f;
-        }
-        if (args.size() > 0) {
-            std::visit(overloaded{[this, &pos](auto offset) {
-                                      if (offset >= pos) {
-                                          std::cout << "z(b): " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision) << offset - pos
-                                                    << std::endl;
-                                      } else {
-                                          std::cout << "z(b): " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision) << pos - offset
-                                                    << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "z(b): " << std::fixed << std::setprecision(m_player.precision) << pos << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "outvx") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](auto offset) {
-                                      if (offset >= m_player.velocity.x) {
-                                          std::cout << "Vx: " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << offset - m_player.velocity.x << std::endl;
-                                      } else {
-                                          std::cout << "Vx: " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << m_player.velocity.x - offset << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "Vx: " << std::fixed << std::setprecision(m_player.precision) << m_player.velocity.x
-                      << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "outvz") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](auto offset) {
-                                      if (offset >= m_player.velocity.z) {
-                                          std::cout << "Vz: " << offset << " - " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << offset - m_player.velocity.z << std::endl;
-                                      } else {
-                                          std::cout << "Vz: " << offset << " + " << std::fixed
-                                                    << std::setprecision(m_player.precision)
-                                                    << m_player.velocity.z - offset << std::endl;
-                                      }
-                                  },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            std::cout << "Vz: " << std::fixed << std::setprecision(m_player.precision) << m_player.velocity.z
-                      << std::endl;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "setx") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](int offset) { m_player.position.x = static_cast<float>(offset); },
-                                  [this](float offset) { m_player.position.x = offset; },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            m_player.position.x = 0.0f;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "setz") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](int offset) { m_player.position.z = static_cast<float>(offset); },
-                                  [this](float offset) { m_player.position.z = offset; },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            m_player.position.z = 0.0f;
-        }
-        return std::nullopt;
-    }
-    if (identifier == "setvx") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](int offset) { m_player.velocity.x = static_cast<float>(offset); },
-                                  [this](float offset) { m_player.velocity.x = offset; },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            m_player.velocity.x = 0.0f;
-        }
+}
+
+OptionalValue CodeVisitor::visitCallExpr(CallExpr& expr) {
+    if (expr.slot < m_functions.size() && m_functions[expr.slot]) {
+        FuncDeclStmt* func = m_functions[expr.slot];
+        size_t variablesSize = m_variables.bound.size();
+        if (expr.arguments.size() < func->slots.size()) throw std::runtime_error("Not enough arguments");
+        for (size_t i = 0; i < func->slots.size(); i++) bind(func->slots[i], expr.arguments[i]->accept(*this).value());
+        func->body->accept(*this);
+        unbind(variablesSize);
         return std::nullopt;
     }
-    if (identifier == "setvz") {
-        if (args.size() > 0) {
-            std::visit(overloaded{[this](int offset) { m_player.velocity.z = static_cast<float>(offset); },
-                                  [this](float offset) { m_player.velocity.z = offset; },
-                                  [](bool) { throw std::runtime_error("Expected float got bool instead"); },
-                                  [](std::string) { throw std::runtime_error("Expected float got string instead"); }},
-                       args[0]);
-        } else {
-            m_player.velocity.z = 0.0f;
-        }
+    if (expr.builtin == Builtin::Reset) {
+        callBuiltin(Builtin::Reset, m_player, {}, *m_output, *m_recorder, m_snapshots);
         return std::nullopt;
     }
-    if (identifier == "print") {
-        if (args.size() > 0) {
-            for (auto& arg : args) {
-                std::visit(
-                    overloaded{[](auto arg) { std::cout << arg; }, [](bool arg) { std::cout << std::boolalpha << arg; },
-                               [](std::string& str) { std::cout << str.substr(1, str.size() - 2); }},
-                    arg);
+
+    if (expr.builtin.has_value()) {
+        std::vector<Value> args;
+        for (auto& arg : expr.arguments) {
+            if (auto result = arg->accept(*this); result.has_value()) {
+                args.push_back(result.value());
+            } else {
+                throw std::runtime_error("Error invalid argument");
             }
-            std::cout << std::endl;
-        } else {
-            throw std::runtime_error("Nothing to print");
         }
+        callBuiltin(expr.builtin.value(), m_player, args, *m_output, *m_recorder, m_snapshots);
         return std::nullopt;
     }
 
-    bool isSneaking = false;
-    bool isSprinting = false;
-    State state = State::GROUNDED;
-    std::optional<float> slipperiness = std::nullopt;
-    m_player.inputs = expr.inputs;
-    if (m_player.inputs.empty()) m_player.inputs = "w";
-    // std::vector<std::vector<std::string>> keywords{{"sneak"}, {"walk", "sprint", "stop"}, {"jump", "air", "ground"}};
-    if (stringCheck(identifier, "sneak") || stringCheck(identifier, "sn")) {
-        isSneaking = true;
+    // Every argument is evaluated, only the first two mean anything to a movement.
+    OptionalValue first, second;
+    for (size_t i = 0; i < expr.arguments.size(); i++) {
+        OptionalValue result = expr.arguments[i]->accept(*this);
+        if (!result.has_value()) throw std::runtime_error("Error invalid argument");
+        if (i == 0) first = std::move(result);
+        if (i == 1) second = std::move(result);
     }
-    if (stringCheck(identifier, "stop") || stringCheck(identifier, "st")) {
-        m_player.inputs = "";
-    } else if (stringCheck(identifier, "sprint") || stringCheck(identifier, "s")) {
-        isSprinting = true;
-    } else {
-        stringCheck(identifier, "walk") || stringCheck(identifier, "w");
-    }
-    if (stringCheck(identifier, "jump") || stringCheck(identifier, "j")) {
-        state = State::JUMPING;
-    } else if (stringCheck(identifier, "air") || stringCheck(identifier, "a")) {
-        state = State::AIRBORNE;
-        slipperiness = 1.0f;
-    }
-    float offset = 0.0f;
-    if (stringCheck(identifier, "45")) offset = 45.0f;
+
     int duration = 1;
     std::optional<float> rotation = std::nullopt;
-    if (args.size() > 0) {
+    if (first.has_value()) {
         std::visit(overloaded{[&duration](int value) { duration = value; },
                               [&duration](float value) { duration = static_cast<int>(value); },
                               [](bool) { throw std::runtime_error("Expected int got bool instead"); },
-                              [](std::string) { throw std::runtime_error("Expected int got string instead"); }},
-                   args[0]);
+                              [](const std::string&) { throw std::runtime_error("Expected int got string instead"); }},
+                   first.value());
     }
-    if (args.size() > 1) {
+    if (second.has_value()) {
         std::visit(overloaded{[&rotation](int value) { rotation = static_cast<float>(value); },
                               [&rotation](float value) { rotation = value; },
                               [](bool) { throw std::runtime_error("Expected int got bool instead"); },
-                              [](std::string) { throw std::runtime_error("Expected int got string instead"); }},
-                   args[1]);
-    }
-    if (m_tap) {
-        for (int i = 0; i < duration; i++) {
-            std::string inputs = m_player.inputs;
-            m_player.move(1, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
-                          state);
-            m_player.inputs = "";
-            while (m_player.velocity.sqrMagnitude() > 0.0) {
-                m_player.move(1, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
-                              state);
-            }
-            m_player.inputs = inputs;
-        }
-    } else if (offset == 45.0f && state == State::JUMPING && isSprinting) {
-        m_player.move(1, rotation, 0.0f, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt, state);
-        m_player.move(duration - 1, rotation, offset, 1.0f, isSprinting, isSneaking, std::nullopt, std::nullopt,
-                      State::AIRBORNE);
-    } else {
-        m_player.move(duration, rotation, offset, slipperiness, isSprinting, isSneaking, std::nullopt, std::nullopt,
-                      state);
+                              [](const std::string&) { throw std::runtime_error("Expected int got string instead"); }},
+                   second.value());
     }
+    performMovement(m_player, expr.movement, duration, rotation, m_tap);
     return std::nullopt;
 }
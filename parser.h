@@ -1,72 +1,200 @@
 #pragma once
 #include <regex.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
 #include <memory>
+#include <memory_resource>
 #include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "lexer.h"
 #include "player.h"
+#include "recorder.h"
+
+class Output;
 
 using Value = std::variant<int, float, bool, std::string>;
 using OptionalValue = std::optional<Value>;
+
+enum class Operator : uint8_t {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    LessThan,
+    GreaterThan,
+    LessThanOrEquals,
+    GreaterThanOrEquals,
+    Equals,
+    NotEquals,
+    And,
+    Or
+};
+// What an expression is known to evaluate to before it runs, Dynamic when that depends on the run.
+enum class StaticType : uint8_t { Dynamic, Integer, Float, Boolean, String };
+
+// The arithmetic of both backends. Throws like the script would on invalid operands.
+OptionalValue evaluateUnary(Operator op, const Value& operand);
+OptionalValue evaluateBinary(Operator op, const Value& lhs, const Value& rhs);
+
+// The player fields a script reads and assigns like variables. They can't be shadowed.
+enum class Field : uint8_t { X, Z, VX, VZ };
+std::optional<Field> findField(std::string_view identifier);
+
+enum class Builtin {
+    Reset,
+    Facing,
+    OutX,
+    OutZ,
+    XMM,
+    ZMM,
+    XB,
+    ZB,
+    OutVX,
+    OutVZ,
+    SetX,
+    SetZ,
+    SetVX,
+    SetVZ,
+    Print,
+    Flush,
+    Record,
+    History,
+    Save,
+    Restore,
+    Version
+};
+std::optional<Builtin> findBuiltin(std::string_view identifier);
+std::string_view builtinName(Builtin builtin);
+
+// Players saved with `save`, by the name given to it.
+using Snapshots = std::unordered_map<std::string, Player>;
+
+// Everything a movement identifier like "sneaksprintjump45.wa" encodes. `keys` is a mask of Key bits.
+struct Movement {
+    uint8_t keys = keyMask("w");
+    std::optional<float> slipperiness = std::nullopt;
+    float offset = 0.0f;
+    State state = State::GROUNDED;
+    bool isSprinting = false;
+    bool isSneaking = false;
+    Player::Modifiers modifiers = Player::Modifiers::NONE;
+    bool operator==(const Movement&) const = default;
+};
+Movement decodeMovement(std::string_view identifier, std::string_view inputs);
+// The modifier a [name] after a movement stands for.
+std::optional<Player::Modifiers> findModifier(std::string_view name);
+
+// Owns every node of a parsed script. Nodes are bumped out of a few large blocks and freed together with them, their
+// destructors never run, so they hold nothing but arena pointers, spans and views.
+class Arena {
+   private:
+    std::pmr::monotonic_buffer_resource m_memory{64 * 1024};
+
+   public:
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        return new (m_memory.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    std::string_view copy(std::string_view text) {
+        char* data = static_cast<char*>(m_memory.allocate(text.size(), 1));
+        std::copy(text.begin(), text.end(), data);
+        return std::string_view(data, text.size());
+    }
+    // Moves the items pushed onto `stack` since `mark` into the arena.
+    template <typename T>
+    std::span<T> take(std::vector<T>& stack, size_t mark) {
+        size_t count = stack.size() - mark;
+        if (count == 0) return {};
+        T* data = static_cast<T*>(m_memory.allocate(count * sizeof(T), alignof(T)));
+        std::uninitialized_move(stack.begin() + mark, stack.end(), data);
+        stack.resize(mark);
+        return std::span<T>(data, count);
+    }
+};
 struct Expr {
     virtual ~Expr() = default;
     virtual OptionalValue accept(struct ExprVisitor& visitor) = 0;
 };
 
+// Numbers and booleans are converted once, when the literal is created. One that is out of range is not `valid`,
+// evaluate() then throws what the conversion did, so the script only fails if it gets there.
 struct LiteralExpr : public Expr {
     enum class Type { Integer, Float, Boolean, String };
     Type type;
-    std::string value;
+    std::string_view value;
+    bool valid = true;
+    int integer = 0;
+    float floating = 0.0f;
+    bool boolean = false;
     OptionalValue accept(struct ExprVisitor& visitor) override;
-    LiteralExpr(Type type, std::string value) : type(type), value(value) {}
+    Value evaluate() const;
+    StaticType staticType() const;
+    LiteralExpr(Type type, std::string_view value);
+    explicit LiteralExpr(int integer) : type(Type::Integer), integer(integer) {}
+    explicit LiteralExpr(float floating) : type(Type::Float), floating(floating) {}
+    explicit LiteralExpr(bool boolean) : type(Type::Boolean), boolean(boolean) {}
 };
 
+// Names are resolved by the scanner: `slot` is the same for every use of a name, `field` is set for player fields.
 struct VarExpr : public Expr {
-    std::string identifier;
+    std::string_view identifier;
+    uint32_t slot;
+    std::optional<Field> field;
     OptionalValue accept(struct ExprVisitor& visitor) override;
-    VarExpr(std::string identifier) : identifier(identifier) {}
+    VarExpr(std::string_view identifier, uint32_t slot)
+        : identifier(identifier), slot(slot), field(findField(identifier)) {}
 };
 
 struct AssignExpr : public Expr {
-    std::string identifier;
-    std::unique_ptr<Expr> value;
+    std::string_view identifier;
+    uint32_t slot;
+    std::optional<Field> field;
+    Expr* value;
     OptionalValue accept(struct ExprVisitor& visitor) override;
-    AssignExpr(std::string identifier, std::unique_ptr<Expr> value) : identifier(identifier), value(std::move(value)) {}
+    AssignExpr(std::string_view identifier, uint32_t slot, Expr* value)
+        : identifier(identifier), slot(slot), field(findField(identifier)), value(value) {}
 };
 
 struct CallExpr : public Expr {
    public:
-    std::string identifier;
-    std::vector<std::string> modifiers;
-    std::string inputs;
-    std::vector<std::unique_ptr<Expr>> arguments;
+    std::string_view identifier;
+    uint32_t slot = 0;
+    std::string_view inputs;
+    std::span<Expr*> arguments;
+    // Decoded by the scanner. A call that is neither a builtin nor a function performs `movement`.
+    std::optional<Builtin> builtin;
+    Movement movement;
     OptionalValue accept(struct ExprVisitor& visitor) override;
 };
 
+// `operands` is Integer or Float when the Optimizer has proven every operand is of that type, Dynamic otherwise.
 struct UnaryExpr : public Expr {
-    std::unique_ptr<Expr> operand;
-    std::string operation;
+    Expr* operand;
+    Operator op;
+    StaticType operands = StaticType::Dynamic;
     OptionalValue accept(struct ExprVisitor& visitor) override;
-    UnaryExpr() {}
-    explicit UnaryExpr(std::unique_ptr<Expr> operand, std::string& operation)
-        : operand(std::move(operand)), operation{operation} {}
+    explicit UnaryExpr(Expr* operand, Operator op) : operand(operand), op(op) {}
 };
 
 struct BinaryExpr : public Expr {
-    std::unique_ptr<Expr> lhs;
-    std::string operation;
-    std::unique_ptr<Expr> rhs;
+    Expr* lhs;
+    Operator op;
+    Expr* rhs;
+    StaticType operands = StaticType::Dynamic;
     OptionalValue accept(struct ExprVisitor& visitor) override;
 
-    BinaryExpr() {}
-    explicit BinaryExpr(std::unique_ptr<Expr> lhs, std::string& op, std::unique_ptr<Expr> rhs)
-        : lhs(std::move(lhs)), operation{op}, rhs(std::move(rhs)) {}
+    explicit BinaryExpr(Expr* lhs, Operator op, Expr* rhs) : lhs(lhs), op(op), rhs(rhs) {}
 };
 
 struct ExprVisitor {
@@ -84,47 +212,67 @@ struct Stmt {
 };
 
 struct ExprStmt : public Stmt {
-    std::unique_ptr<Expr> expression;
+    Expr* expression;
     void accept(struct StmtVisitor& visitor) override;
-    ExprStmt() = default;
-    ExprStmt(std::unique_ptr<Expr> expression) : expression(std::move(expression)) {}
+    ExprStmt(Expr* expression) : expression(expression) {}
 };
 
 struct BlockStmt : public Stmt {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    std::span<Stmt*> statements;
     bool tap = false;
     void accept(struct StmtVisitor& visitor) override;
 };
 
 struct IfStmt : public Stmt {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> thenBranch;
-    std::unique_ptr<Stmt> elseBranch;
+    Expr* condition = nullptr;
+    Stmt* thenBranch = nullptr;
+    Stmt* elseBranch = nullptr;
     void accept(struct StmtVisitor& visitor) override;
 };
 
 struct ForStmt : public Stmt {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> body;
+    Expr* condition = nullptr;
+    Stmt* body = nullptr;
     void accept(struct StmtVisitor& visitor) override;
 };
 
 struct WhileStmt : public Stmt {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> body;
+    Expr* condition = nullptr;
+    Stmt* body = nullptr;
     void accept(struct StmtVisitor& visitor) override;
 };
 
 struct VarDeclStmt : public Stmt {
-    std::string identifier;
-    std::unique_ptr<Expr> value;
+    std::string_view identifier;
+    uint32_t slot = 0;
+    Expr* value = nullptr;
     void accept(struct StmtVisitor& visitor) override;
 };
 
 struct FuncDeclStmt : public Stmt {
-    std::string identifier;
-    std::vector<std::string> parameters;
-    std::unique_ptr<Stmt> body;
+    std::string_view identifier;
+    uint32_t slot = 0;
+    std::span<std::string_view> parameters;
+    std::span<uint32_t> slots;
+    Stmt* body = nullptr;
+    void accept(struct StmtVisitor& visitor) override;
+};
+
+// optimize angle -45.0 45.0 0.5 { ... } maximize z
+// Runs the body for every combination of the parameter ranges, then once more for real with the best one.
+struct OptimizeStmt : public Stmt {
+    enum class Goal { Maximize, Minimize, Until };
+    struct Parameter {
+        std::string_view identifier;
+        uint32_t slot;
+        Expr* from;
+        Expr* to;
+        Expr* step;
+    };
+    std::span<Parameter> parameters;
+    Stmt* body = nullptr;
+    Goal goal = Goal::Maximize;
+    Expr* objective = nullptr;
     void accept(struct StmtVisitor& visitor) override;
 };
 
@@ -136,20 +284,45 @@ struct StmtVisitor {
     virtual void visitWhileStmt(WhileStmt& stmt) = 0;
     virtual void visitVarDeclStmt(VarDeclStmt& stmt) = 0;
     virtual void visitFuncDeclStmt(FuncDeclStmt& stmt) = 0;
+    virtual void visitOptimizeStmt(OptimizeStmt& stmt) = 0;
 };
 
 struct CodeVisitor : public ExprVisitor, public StmtVisitor {
    private:
-    struct Var {
-        std::string identifier;
-        OptionalValue value;
+    // Scoping is dynamic, a function sees the variables of its caller. Every slot keeps the values its name is bound
+    // to, innermost last, and m_bound the slot of every binding in order, so leaving a scope pops them again.
+    struct Variables {
+        std::vector<std::vector<OptionalValue>> bindings;
+        std::vector<uint32_t> bound;
     };
     bool m_tap = false;
-    std::vector<Var> m_variables;
-    std::vector<FuncDeclStmt> m_functions;
+    Variables m_variables;
+    // By slot, the first declaration of a name wins.
+    std::vector<FuncDeclStmt*> m_functions;
     Player m_player;
+    Output* m_output;
+    // What record and history use, m_player points to it while recording.
+    std::shared_ptr<Recorder> m_recorder = std::make_shared<Recorder>();
+    Snapshots m_snapshots;
+    // Where failed statements are reported, nowhere while optimize tries candidates.
+    std::ostream* m_errors = &std::cerr;
+
+   private:
+    void bind(uint32_t slot, OptionalValue value);
+    void unbind(size_t count);
+    OptionalValue* lookup(uint32_t slot);
+    double& field(Field field);
 
    public:
+    // Writes to Output::standard() unless given another output.
+    CodeVisitor();
+    explicit CodeVisitor(Output& output) : m_output(&output) {}
+    CodeVisitor(Output& output, std::ostream& errors) : m_output(&output), m_errors(&errors) {}
+
+    // Binds a variable for the whole run, as if the script started with a let. See Script::names for the slot.
+    void define(uint32_t slot, Value value) { bind(slot, std::move(value)); }
+    Player& player() { return m_player; }
+
     OptionalValue visitLiteralExpr(LiteralExpr& expr) override;
     OptionalValue visitVarExpr(VarExpr& expr) override;
     OptionalValue visitAssignExpr(AssignExpr& expr) override;
@@ -164,89 +337,134 @@ struct CodeVisitor : public ExprVisitor, public StmtVisitor {
     void visitWhileStmt(WhileStmt& stmt) override;
     void visitVarDeclStmt(VarDeclStmt& stmt) override;
     void visitFuncDeclStmt(FuncDeclStmt& stmt) override;
+    void visitOptimizeStmt(OptimizeStmt& stmt) override;
+};
+
+// A parsed script. Dropping it frees the whole tree at once.
+struct Script {
+    std::unique_ptr<Arena> arena;
+    BlockStmt* root = nullptr;
+    // The name of every slot, by slot. Empty for slots no name in the tree uses.
+    std::vector<std::string_view> names;
 };
 
 class Scanner {
    private:
-    std::vector<Token> m_tokens;
+    // A ring over the token stream. The parser never backs up more than a couple of tokens, so a reference from
+    // consume() or peek() stays good until many more have been read.
+    std::array<Token, 16> m_tokens;
+    size_t m_lexed = 0;
     Lexer m_lexer;
     size_t m_pos = -1;
     struct FunctionData {
-        std::string identifier;
+        uint32_t id;
         size_t numberOfArguments;
     };
     std::vector<FunctionData> m_functions;
+    std::unique_ptr<Arena> m_arena = std::make_unique<Arena>();
+    // The arena copy of every interned name, by id.
+    std::vector<std::string_view> m_names;
+    // Children of the nodes being parsed, moved into the arena once a node is complete.
+    std::vector<Stmt*> m_statements;
+    std::vector<Expr*> m_arguments;
+    std::vector<std::string_view> m_parameters;
+    std::vector<uint32_t> m_slots;
+    std::vector<OptimizeStmt::Parameter> m_optimizeParameters;
 
    private:
-    Token& current() { return m_tokens[m_pos]; }
-    Token consume() {
-        Token token;
-        if (++m_pos >= m_tokens.size()) {
+    const Token& current() { return m_tokens[m_pos % m_tokens.size()]; }
+    // Literals are copied to the arena as they enter the ring, before the lexer can overwrite them.
+    const Token& consume() {
+        if (++m_pos == m_lexed) {
+            Token& token = m_tokens[m_pos % m_tokens.size()];
             token = m_lexer.next();
-            m_tokens.push_back(token);
-        } else {
-            token = m_tokens[m_pos];
+            if (token.type == TokenType::Integer || token.type == TokenType::Float || token.type == TokenType::String) {
+                token.text = m_arena->copy(token.text);
+            }
+            m_lexed++;
         }
-        return token;
+        return current();
     }
-    Token peek() {
-        Token token = consume();
+    const Token& peek() {
+        const Token& token = consume();
         m_pos--;
         return token;
     }
     // bool accept();
     // bool expect();
-    void addModifiers(CallExpr& callExpr) {
+    // Text that lives as long as the tree. Names are copied to the arena once per id, everything else already is
+    // there or is a string constant.
+    std::string_view text(const Token& token) {
+        if (token.type != TokenType::Identifier && token.type != TokenType::Builtin &&
+            token.type != TokenType::Movement && token.type != TokenType::Modifier) {
+            return token.text;
+        }
+        if (token.id >= m_names.size()) m_names.resize(token.id + 1);
+        if (m_names[token.id].data() == nullptr) m_names[token.id] = m_arena->copy(token.text);
+        return m_names[token.id];
+    }
+    // The inputs go to the call, the [name] modifiers are returned for its movement.
+    Player::Modifiers addModifiers(CallExpr& callExpr) {
+        u_int32_t modifiers = 0;
         while (peek().type == TokenType::Modifier) {
-            Token token = consume();
+            const Token& token = consume();
             switch (token.text[0]) {
                 case '.':
-                    callExpr.inputs = token.text.substr(1);
+                    callExpr.inputs = text(token).substr(1);
                     break;
-                case '[':
-                    // TODO: Implement
+                case '[': {
+                    std::string_view name = token.text.substr(1, token.text.size() - 2);
+                    std::optional<Player::Modifiers> modifier = findModifier(name);
+                    if (!modifier.has_value()) throw std::runtime_error("Unknown modifier " + std::string(token.text));
+                    modifiers |= static_cast<u_int32_t>(modifier.value());
                     break;
+                }
             }
         }
+        return static_cast<Player::Modifiers>(modifiers);
     }
     template <typename T, typename... Args>
-    std::unique_ptr<Expr> makeExpr(Args&&... args) {
-        return std::make_unique<T>(std::forward<Args>(args)...);
+    Expr* makeExpr(Args&&... args) {
+        return m_arena->make<T>(std::forward<Args>(args)...);
     }
     int getPrec() { return 0; }
-    std::unique_ptr<Expr> prattParse(int mininumPrecedence = 0) {
+    Expr* prattParse(int mininumPrecedence = 0) {
         // Increasing order of precedence
-        const std::unordered_map<TokenType, int> precedence = {
-            {TokenType::Or, 1},
-            {TokenType::And, 2},
-            {TokenType::Equals, 3},
-            {TokenType::NotEquals, 3},
-            {TokenType::LessThan, 4},
-            {TokenType::GreaterThan, 4},
-            {TokenType::LessThanOrEquals, 4},
-            {TokenType::GreaterThanOrEquals, 4},
-            {TokenType::Add, 5},
-            {TokenType::Subtract, 5},
-            {TokenType::Multiply, 6},
-            {TokenType::Divide, 6},
+        struct Binary {
+            int precedence;
+            Operator op;
+        };
+        static const std::unordered_map<TokenType, Binary> binaries = {
+            {TokenType::Or, {1, Operator::Or}},
+            {TokenType::And, {2, Operator::And}},
+            {TokenType::Equals, {3, Operator::Equals}},
+            {TokenType::NotEquals, {3, Operator::NotEquals}},
+            {TokenType::LessThan, {4, Operator::LessThan}},
+            {TokenType::GreaterThan, {4, Operator::GreaterThan}},
+            {TokenType::LessThanOrEquals, {4, Operator::LessThanOrEquals}},
+            {TokenType::GreaterThanOrEquals, {4, Operator::GreaterThanOrEquals}},
+            {TokenType::Add, {5, Operator::Add}},
+            {TokenType::Subtract, {5, Operator::Subtract}},
+            {TokenType::Multiply, {6, Operator::Multiply}},
+            {TokenType::Divide, {6, Operator::Divide}},
         };
-        std::unique_ptr<Expr> lhs;
+        Expr* lhs;
         Token left = consume();
         switch (left.type) {
             case TokenType::Integer: {
-                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Integer, left.text);
+                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Integer, text(left));
                 break;
             }
             case TokenType::Float: {
-                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Float, left.text);
+                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Float, text(left));
                 break;
             }
             case TokenType::Boolean: {
-                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Boolean, left.text);
+                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::Boolean, text(left));
                 break;
             }
             case TokenType::String: {
-                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::String, left.text);
+                lhs = makeExpr<LiteralExpr>(LiteralExpr::Type::String, text(left));
                 break;
             }
             case TokenType::LeftParen: {
@@ -256,16 +474,17 @@ class Scanner {
             }
             case TokenType::Add:
             case TokenType::Subtract:
-                lhs = makeExpr<UnaryExpr>(prattParse(10), left.text);
+                lhs = makeExpr<UnaryExpr>(prattParse(10),
+                                          left.type == TokenType::Add ? Operator::Add : Operator::Subtract);
                 break;
             case TokenType::Identifier: {
                 if (isFunction(left)) {
                     lhs = createCallExpr();
                 } else if (peek().type == TokenType::Assign) {
                     consume();
-                    lhs = makeExpr<AssignExpr>(left.text, prattParse());
+                    lhs = makeExpr<AssignExpr>(text(left), left.id, prattParse());
                 } else {
-                    lhs = makeExpr<VarExpr>(left.text);
+                    lhs = makeExpr<VarExpr>(text(left), left.id);
                 }
                 break;
                 // TODO: Handle function calls inside expressions
@@ -274,10 +493,11 @@ class Scanner {
             default:
                 throw std::runtime_error("Invalid token");
         }
-        while (precedence.contains(peek().type) && precedence.at(peek().type) >= mininumPrecedence) {
-            Token op = consume();
-            std::unique_ptr<Expr> rhs = prattParse(precedence.at(op.type) + 1);
-            lhs = makeExpr<BinaryExpr>(std::move(lhs), op.text, std::move(rhs));
+        for (auto it = binaries.find(peek().type); it != binaries.end() && it->second.precedence >= mininumPrecedence;
+             it = binaries.find(peek().type)) {
+            consume();
+            Expr* rhs = prattParse(it->second.precedence + 1);
+            lhs = makeExpr<BinaryExpr>(lhs, it->second.op, rhs);
         }
         return lhs;
     }
@@ -285,14 +505,15 @@ class Scanner {
         int argumentsLeft = -1;
         if (current().type == TokenType::Identifier) {
             for (auto& functionData : m_functions) {
-                if (current().text == functionData.identifier) {
+                if (current().id == functionData.id) {
                     argumentsLeft = functionData.numberOfArguments;
                 }
             }
         }
-        Token token = peek();
+        size_t mark = m_arguments.size();
+        TokenType type = peek().type;
         while (argumentsLeft == -1 || argumentsLeft > 0) {
-            switch (token.type) {
+            switch (type) {
                 case TokenType::String:
                 case TokenType::Boolean:
                 case TokenType::Identifier:
@@ -301,135 +522,187 @@ class Scanner {
                 case TokenType::LeftParen:
                 case TokenType::Add:
                 case TokenType::Subtract: {
-                    callExpr.arguments.push_back(prattParse());
+                    m_arguments.push_back(prattParse());
                     break;
                 }
                 default:
+                    callExpr.arguments = m_arena->take(m_arguments, mark);
                     return;
             }
-            token = peek();
+            type = peek().type;
             if (argumentsLeft > 0) argumentsLeft--;
         }
+        callExpr.arguments = m_arena->take(m_arguments, mark);
     }
 
-    std::unique_ptr<Expr> createCallExpr() {
-        CallExpr callExpr;
-        callExpr.identifier = current().text;
-        addModifiers(callExpr);
-        addArguments(callExpr);
-        return std::make_unique<CallExpr>(std::move(callExpr));
+    Expr* createCallExpr() {
+        CallExpr* callExpr = m_arena->make<CallExpr>();
+        callExpr->identifier = text(current());
+        callExpr->slot = current().id;
+        Player::Modifiers modifiers = addModifiers(*callExpr);
+        callExpr->builtin = findBuiltin(callExpr->identifier);
+        if (!callExpr->builtin.has_value()) {
+            callExpr->movement = decodeMovement(callExpr->identifier, callExpr->inputs);
+            callExpr->movement.modifiers = modifiers;
+        }
+        addArguments(*callExpr);
+        return callExpr;
     }
 
-    bool isFunction(Token& token) {
+    bool isFunction(const Token& token) {
         if (token.type == TokenType::Builtin || token.type == TokenType::Movement) return true;
         for (auto& functionData : m_functions) {
-            if (token.text == functionData.identifier) return true;
+            if (token.type == TokenType::Identifier && token.id == functionData.id) return true;
         }
         return false;
     }
 
-    std::unique_ptr<Stmt> parseStmt() {
+    Stmt* parseStmt() {
         switch (current().type) {
             case TokenType::Builtin:
             case TokenType::Movement:
             case TokenType::Identifier: {
-                ExprStmt exprStmt;
+                Expr* expression;
                 if (isFunction(current())) {
-                    exprStmt = createCallExpr();
+                    expression = createCallExpr();
                 } else {
                     m_pos--;
-                    exprStmt = prattParse();
+                    expression = prattParse();
                 }
-                return std::make_unique<ExprStmt>(std::move(exprStmt));
+                return m_arena->make<ExprStmt>(expression);
             }
             case TokenType::Let: {
-                Token token = consume();
+                const Token& token = consume();
                 if (token.type != TokenType::Identifier) throw std::runtime_error("Invalid variable name");
 
-                VarDeclStmt varDecl;
-                varDecl.identifier = token.text;
+                VarDeclStmt* varDecl = m_arena->make<VarDeclStmt>();
+                varDecl->identifier = text(token);
+                varDecl->slot = token.id;
                 if (consume().type != TokenType::Assign) throw std::runtime_error("Expected =");
-                varDecl.value = prattParse();
-                return std::make_unique<VarDeclStmt>(std::move(varDecl));
+                varDecl->value = prattParse();
+                return varDecl;
             }
             case TokenType::FuncDecl: {
-                Token token = consume();
+                const Token& token = consume();
                 if (token.type != TokenType::Identifier) throw std::runtime_error("Invalid function name");
 
-                FuncDeclStmt funcDecl;
-                funcDecl.identifier = token.text;
+                FuncDeclStmt* funcDecl = m_arena->make<FuncDeclStmt>();
+                funcDecl->identifier = text(token);
+                funcDecl->slot = token.id;
 
-                token = consume();
-                if (token.type != TokenType::LeftParen) throw std::runtime_error("Expected (");
-                while (consume().type == TokenType::Identifier) funcDecl.parameters.push_back(current().text);
+                if (consume().type != TokenType::LeftParen) throw std::runtime_error("Expected (");
+                size_t mark = m_parameters.size();
+                while (consume().type == TokenType::Identifier) {
+                    m_parameters.push_back(text(current()));
+                    m_slots.push_back(current().id);
+                }
+                funcDecl->parameters = m_arena->take(m_parameters, mark);
+                funcDecl->slots = m_arena->take(m_slots, mark);
                 if (current().type == TokenType::RightParen) consume();
                 if (current().type == TokenType::Movement || current().type == TokenType::Builtin)
                     throw std::runtime_error("Can't override builtin functions");
 
-                funcDecl.body = parseStmt();
-                m_functions.push_back(FunctionData{funcDecl.identifier, funcDecl.parameters.size()});
-                return std::make_unique<FuncDeclStmt>(std::move(funcDecl));
+                funcDecl->body = parseStmt();
+                m_functions.push_back(FunctionData{funcDecl->slot, funcDecl->parameters.size()});
+                return funcDecl;
             }
             case TokenType::For: {
-                ForStmt forStmt;
-                forStmt.condition = prattParse();
+                ForStmt* forStmt = m_arena->make<ForStmt>();
+                forStmt->condition = prattParse();
                 consume();
-                forStmt.body = parseStmt();
-                return std::make_unique<ForStmt>(std::move(forStmt));
+                forStmt->body = parseStmt();
+                return forStmt;
             }
             case TokenType::While: {
-                WhileStmt whileStmt;
-                whileStmt.condition = prattParse();
+                WhileStmt* whileStmt = m_arena->make<WhileStmt>();
+                whileStmt->condition = prattParse();
                 consume();
-                whileStmt.body = parseStmt();
-                return std::make_unique<WhileStmt>(std::move(whileStmt));
+                whileStmt->body = parseStmt();
+                return whileStmt;
             }
             case TokenType::If: {
-                IfStmt ifStmt;
-                ifStmt.condition = prattParse();
+                IfStmt* ifStmt = m_arena->make<IfStmt>();
+                ifStmt->condition = prattParse();
                 consume();
-                ifStmt.thenBranch = parseStmt();
+                ifStmt->thenBranch = parseStmt();
                 if (peek().type == TokenType::Else) {
                     consume();
                     consume();
-                    ifStmt.elseBranch = parseStmt();
+                    ifStmt->elseBranch = parseStmt();
                 }
-                return std::make_unique<IfStmt>(std::move(ifStmt));
+                return ifStmt;
+            }
+            case TokenType::Optimize: {
+                OptimizeStmt* optimizeStmt = m_arena->make<OptimizeStmt>();
+                size_t mark = m_optimizeParameters.size();
+                while (peek().type == TokenType::Identifier) {
+                    OptimizeStmt::Parameter parameter;
+                    parameter.identifier = text(consume());
+                    parameter.slot = current().id;
+                    parameter.from = prattParse();
+                    parameter.to = prattParse();
+                    parameter.step = prattParse();
+                    m_optimizeParameters.push_back(parameter);
+                }
+                if (m_optimizeParameters.size() == mark) throw std::runtime_error("Expected parameter for optimize");
+                optimizeStmt->parameters = m_arena->take(m_optimizeParameters, mark);
+                consume();
+                optimizeStmt->body = parseStmt();
+
+                const Token& goal = consume();
+                if (goal.text == "maximize") {
+                    optimizeStmt->goal = OptimizeStmt::Goal::Maximize;
+                } else if (goal.text == "minimize") {
+                    optimizeStmt->goal = OptimizeStmt::Goal::Minimize;
+                } else if (goal.text == "until") {
+                    optimizeStmt->goal = OptimizeStmt::Goal::Until;
+                } else {
+                    throw std::runtime_error("Expected maximize, minimize or until");
+                }
+                optimizeStmt->objective = prattParse();
+                return optimizeStmt;
             }
             case TokenType::Tap: {
                 if (peek().type == TokenType::LeftBrace) consume();
-                BlockStmt stmt = scan();
-                stmt.tap = true;
-                return std::make_unique<BlockStmt>(std::move(stmt));
+                BlockStmt* stmt = parseBlock();
+                stmt->tap = true;
+                return stmt;
             }
             case TokenType::LeftBrace: {
-                return std::make_unique<BlockStmt>(scan());
+                return parseBlock();
             }
             case TokenType::Semicolon: {
-                if (consume().type == TokenType::RightBrace) return std::unique_ptr<Stmt>();
+                if (consume().type == TokenType::RightBrace) return nullptr;
                 return parseStmt();
             }
             case TokenType::EndOfFile: {
-                return std::unique_ptr<Stmt>();
+                return nullptr;
             }
             default:
                 break;
         }
-        throw std::runtime_error("Error while parsing statement: " + current().text);
+        throw std::runtime_error("Error while parsing statement: " + std::string(current().text));
     }
 
-   public:
-    BlockStmt scan() {
-        BlockStmt block;
+    BlockStmt* parseBlock() {
+        BlockStmt* block = m_arena->make<BlockStmt>();
+        size_t mark = m_statements.size();
         while (consume().type != TokenType::EndOfFile && current().type != TokenType::RightBrace) {
-            std::unique_ptr<Stmt> stmt = parseStmt();
-            if (stmt) {
-                block.statements.push_back(std::move(stmt));
-            } else {
-                return block;
-            }
+            Stmt* stmt = parseStmt();
+            if (!stmt) break;
+            m_statements.push_back(stmt);
         }
+        block->statements = m_arena->take(m_statements, mark);
         return block;
     }
+
+   public:
+    // The tree comes with the arena that holds it, the scanner starts over with a new one.
+    Script scan() {
+        BlockStmt* root = parseBlock();
+        return Script{std::exchange(m_arena, std::make_unique<Arena>()), root, std::exchange(m_names, {})};
+    }
     Scanner(const std::string& input) : m_lexer(input) {}
+    // Parses the script read from `fd` as it arrives, see Lexer(int).
+    explicit Scanner(int fd) : m_lexer(fd) {}
 };
@@ -2,9 +2,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
+#include <limits>
 #include <optional>
 
+#include "recorder.h"
+
 void Player::move(int duration, std::optional<float> rotation, float rotationOffset, std::optional<float> slipperiness,
                   bool isSprinting, bool isSneaking, std::optional<int> speedEffect, std::optional<int> slowEffect,
                   State state) {
@@ -23,26 +27,119 @@ void Player::move(int duration, std::optional<float> rotation, float rotationOff
         slipperiness = 0.5f / 0.91f;
     }
 
-    if (rotationOffset == 45) this->inputs = "wa";
+    if (rotationOffset == 45) this->keys = keyMask("wa");
     m_state = state;
 
-    if (((m_sneakDelay && m_previouslySneaking) || (!m_sneakDelay && isSneaking)) && this->hasModifier(Modifiers::LAVA))
-        m_state = State::AIRBORNE;
+    this->withVersion([&](auto version) {
+        this->move<decltype(version)::value>(duration, overrideRotation, rotation.value_or(0.0f), rotationOffset,
+                                             slipperiness.value(), isSprinting, isSneaking, speedEffect.value(),
+                                             slowEffect.value());
+    });
+}
+
+// The ticks of move() with the rules of `V`.
+template <Player::Version V>
+void Player::move(int duration, bool overrideRotation, float rotation, float rotationOffset, float slipperiness,
+                  bool isSprinting, bool isSneaking, int speed, int slow) {
+    if (this->sneaking(rulesOf(V), isSneaking) && this->hasModifier(Modifiers::LAVA)) m_state = State::AIRBORNE;
 
     float sprintjumpBoost = m_sprintjumpBoost;
     if (m_reverse) sprintjumpBoost *= -1;
+    UpdateKernel update =
+        UPDATE_KERNELS[static_cast<size_t>(V)][static_cast<u_int32_t>(m_modifiers) % MODIFIER_COMBINATIONS];
 
     for (int i = 0; i < duration; i++) {
-        this->update(overrideRotation, rotationOffset, isSprinting, isSneaking, slipperiness.value(),
-                     rotation.value_or(0.0f), speedEffect.value(), slowEffect.value(), sprintjumpBoost);
+        // One tick in, the flags are those of this move. Once the jump is over and the slipperiness has caught up,
+        // every further tick is the same.
+        if (i > 0 && !stepExecution && !recorder && m_modifiers == Modifiers::NONE &&
+            (overrideRotation || m_angles.empty()) && m_state != State::JUMPING &&
+            m_previousSlipperiness == slipperiness) {
+            this->repeat<V>(duration - i, overrideRotation, rotationOffset, isSprinting, isSneaking, slipperiness,
+                            rotation, speed, slow);
+            return;
+        }
+        (this->*update)(overrideRotation, rotationOffset, isSprinting, isSneaking, slipperiness, rotation, speed, slow,
+                        sprintjumpBoost);
+    }
+}
+
+// update() for `ticks` identical ticks without modifiers, with everything that doesn't change between them hoisted.
+// Velocity still decays one rounded multiplication at a time, a geometric series would not round the same way. When
+// it has come to rest and nothing accelerates it, the remaining ticks can't change anything and are skipped.
+template <Player::Version V>
+void Player::repeat(int ticks, bool overrideRotation, float rotationOffset, bool isSprinting, bool isSneaking,
+                    float slipperiness, float rotation, int speed, int slow) {
+    if (!overrideRotation) rotation = this->getAngle() + rotationOffset;
+
+    Vector2<float> direction = this->movementValues();
+    if (this->sneaking(rulesOf(V), isSneaking)) direction.scale(0.3f);
+    direction.scale(0.98f);
+    float multiplier = this->getLandMultiplier<V>(slipperiness, isSprinting, speed, slow);
+
+    bool accelerates = false;
+    float accelerationX = 0.0f, accelerationZ = 0.0f;
+    float distance = direction.sqrMagnitude();
+    if (distance > 0.0f) {
+        distance = std::sqrtf(distance);
+        distance = std::max(distance, 1.0f);
+        distance = multiplier / distance;
+        direction.scale(distance);
+        float sinYaw = this->mcsin(rotation * PI / 180.0f);
+        float cosYaw = this->mccos(rotation * PI / 180.0f);
+        accelerationX = direction.z * cosYaw - direction.x * sinYaw;
+        accelerationZ = direction.x * cosYaw + direction.z * sinYaw;
+        accelerates = true;
+    }
+
+    double friction = 0.91 * m_previousSlipperiness;
+    double threshold = rulesOf(V).inertiaThreshold;
+    double x = position.x, z = position.z, vx = velocity.x, vz = velocity.z;
+    // A loop for each, so that neither tests `accelerates` every tick.
+    if (accelerates) {
+        for (int i = 0; i < ticks; i++) {
+            x += vx;
+            z += vz;
+            vx *= friction;
+            vz *= friction;
+            if (std::fabs(vx) < threshold) vx = 0.0f;
+            if (std::fabs(vz) < threshold) vz = 0.0f;
+            vx += accelerationX;
+            vz += accelerationZ;
+        }
+    } else {
+        for (int i = 0; i < ticks; i++) {
+            x += vx;
+            z += vz;
+            if (vx == 0.0 && vz == 0.0 && !std::signbit(vx) && !std::signbit(vz)) {
+                // Adding zero once more only turns a -0.0 position into 0.0, after that it's the identity.
+                break;
+            }
+            vx *= friction;
+            vz *= friction;
+            if (std::fabs(vx) < threshold) vx = 0.0f;
+            if (std::fabs(vz) < threshold) vz = 0.0f;
+        }
+    }
+    position = {x, z};
+    velocity = {vx, vz};
+
+    if (ticks > 0) {
+        m_lastTurn = rotation - m_lastRotation;
+        m_lastRotation = rotation;
     }
 }
 
 float Player::getMovementMultiplier(float slipperiness, bool isSprinting, int16_t speed, int16_t slow) {
-    if (this->hasModifier(Modifiers::WATER) || this->hasModifier(Modifiers::LAVA)) {
-        return 0.02f;
-    } else if (m_state == State::AIRBORNE) {
-        if ((m_airSprintDelay && m_previouslySprinting) || (!m_airSprintDelay && isSprinting)) {
+    if (this->hasModifier(Modifiers::WATER) || this->hasModifier(Modifiers::LAVA)) return 0.02f;
+    return this->withVersion([&](auto version) {
+        return this->getLandMultiplier<decltype(version)::value>(slipperiness, isSprinting, speed, slow);
+    });
+}
+
+template <Player::Version V>
+float Player::getLandMultiplier(float slipperiness, bool isSprinting, int16_t speed, int16_t slow) {
+    if (m_state == State::AIRBORNE) {
+        if (rulesOf(V).airSprintDelay ? m_previouslySprinting : isSprinting) {
             return 0.02f + 0.02f * 0.3f;
         } else {
             return 0.02f;
@@ -58,27 +155,104 @@ float Player::getMovementMultiplier(float slipperiness, bool isSprinting, int16_
     }
 }
 
+float Player::accelerationBound(std::optional<float> slipperiness, bool isSprinting, bool jumps) const {
+    float slip = slipperiness.value_or(m_defaultGroundSlipperiness);
+    if (m_modifiers != Modifiers::NONE || 0.91 * slip > 1.0 || 0.91 * m_previousSlipperiness > 1.0) {
+        return std::numeric_limits<float>::infinity();
+    }
+    Player probe = *this;
+    probe.m_previouslySprinting = true;
+    probe.m_state = State::GROUNDED;
+    float bound = probe.getMovementMultiplier(slip, isSprinting, m_speedEffect, m_slowEffect);
+    probe.m_state = State::AIRBORNE;
+    bound = std::max(bound, probe.getMovementMultiplier(slip, isSprinting, m_speedEffect, m_slowEffect));
+    if (jumps && isSprinting) bound += m_sprintjumpBoost;
+    return bound;
+}
+
+namespace {
+// What the strafe jump probe depends on, packed into the low bits of its cache key.
+constexpr uint64_t JUMPS = 1, REVERSED = 1 << 1, IN_WEB = 1 << 2, ON_LADDER = 1 << 3, VALID = 1 << 4;
+
+// Direct mapped, one per thread so optimize workers never share a line.
+struct StrafeAngleCache {
+    struct Entry {
+        uint64_t key = 0;
+        float angle = 0.0f;
+    };
+    std::array<Entry, 256> entries{};
+    Player::CacheStats stats{};
+};
+thread_local StrafeAngleCache strafeAngleCache;
+}  // namespace
+
+// The facing of a sprint jump from rest with no keys held. It is the first tick of Player::update on just the
+// velocity. Without keys there is no input acceleration, which is why speed, slowness and slipperiness don't matter.
+float Player::probeStrafeJumpAngle(float rotation, uint64_t probe) {
+    Vector2<double> velocity{0.0, 0.0};
+    if (probe & JUMPS) {
+        float sprintjumpBoost = m_sprintjumpBoost;
+        if (probe & REVERSED) sprintjumpBoost *= -1;
+        float facing = rotation * 0.017453292f;
+        velocity.x -= double(mcsin(facing) * sprintjumpBoost);
+        velocity.z += double(mccos(facing) * sprintjumpBoost);
+    }
+
+    if (probe & IN_WEB) velocity.scale(0.25f);
+    if (probe & ON_LADDER) {
+        velocity.x = std::clamp(velocity.x, 0.15, -0.15);
+        velocity.z = std::clamp(velocity.z, 0.15, -0.15);
+    }
+    return std::fabs(180.0 * std::atan2(velocity.x, velocity.z) / PI);
+}
+
+float Player::getOptimalStrafeJumpAngle(bool isSneaking) const {
+    float rotation = m_angles.empty() ? 0.0f : m_angles.front();
+    bool sneaking = this->sneaking(rulesOf(m_version), isSneaking);
+    uint64_t probe = VALID | (sneaking && this->hasModifier(Modifiers::LAVA) ? 0 : JUMPS) | (m_reverse ? REVERSED : 0) |
+                     (this->hasModifier(Modifiers::WEB) ? IN_WEB : 0) |
+                     (this->hasModifier(Modifiers::LADDER) ? ON_LADDER : 0);
+    uint32_t bits;
+    std::memcpy(&bits, &rotation, sizeof(bits));
+    uint64_t key = static_cast<uint64_t>(bits) << 32 | probe;
+
+    StrafeAngleCache& cache = strafeAngleCache;
+    StrafeAngleCache::Entry& entry = cache.entries[(key * 0x9e3779b97f4a7c15ull) >> 56];
+    if (entry.key == key) {
+        cache.stats.hits++;
+        return entry.angle;
+    }
+    cache.stats.misses++;
+    entry.key = key;
+    entry.angle = probeStrafeJumpAngle(rotation, probe);
+    return entry.angle;
+}
+
+Player::CacheStats Player::strafeAngleCacheStats() { return strafeAngleCache.stats; }
+
+template <Player::Version V, u_int32_t Mask>
 void Player::update(bool overrideRotation, float rotationOffset, bool isSprinting, bool isSneaking, float& slipperiness,
                     float rotation, int speed, int slow, float sprintjumpBoost) {
+    State tickState = m_state;
     if (!overrideRotation) rotation = this->getAngle() + rotationOffset;
     this->position.add(this->velocity);
 
-    if (this->hasModifier(Modifiers::SOULSAND)) this->velocity.scale(0.4);
+    if constexpr (includes(Mask, Modifiers::SOULSAND)) this->velocity.scale(0.4);
 
     Vector2<float> direction = this->movementValues();
 
     this->velocity.scale(0.91 * m_previousSlipperiness);
 
-    if (m_inertiaAxis == 1) {
-        if (std::fabs(this->velocity.x) < m_inertiaThreshold || m_previouslyInWeb) this->velocity.x = 0.0f;
-        if (std::fabs(this->velocity.z) < m_inertiaThreshold || m_previouslyInWeb) this->velocity.z = 0.0f;
-    }
+    if (std::fabs(this->velocity.x) < rulesOf(V).inertiaThreshold || m_previouslyInWeb) this->velocity.x = 0.0f;
+    if (std::fabs(this->velocity.z) < rulesOf(V).inertiaThreshold || m_previouslyInWeb) this->velocity.z = 0.0f;
 
-    if (this->hasModifier(Modifiers::BLOCK)) direction.scale(0.2f);
-    if ((m_sneakDelay && m_previouslySneaking) || (!m_sneakDelay && isSneaking)) direction.scale(0.3f);
+    if constexpr (includes(Mask, Modifiers::BLOCK)) direction.scale(0.2f);
+    if (this->sneaking(rulesOf(V), isSneaking)) direction.scale(0.3f);
     direction.scale(0.98f);
 
-    float multiplier = this->getMovementMultiplier(slipperiness, isSprinting, speed, slow);
+    float multiplier = includes(Mask, Modifiers::WATER) || includes(Mask, Modifiers::LAVA)
+                           ? 0.02f
+                           : this->getLandMultiplier<V>(slipperiness, isSprinting, speed, slow);
     m_previousSlipperiness = slipperiness;
 
     if (m_state == State::JUMPING) {
@@ -103,17 +277,32 @@ void Player::update(bool overrideRotation, float rotationOffset, bool isSprintin
         this->velocity.z += direction.x * cosYaw + direction.z * sinYaw;
     }
 
-    if (this->hasModifier(Modifiers::WEB)) this->velocity.scale(0.25f);
-    if (this->hasModifier(Modifiers::LADDER)) {
+    if constexpr (includes(Mask, Modifiers::WEB)) this->velocity.scale(0.25f);
+    if constexpr (includes(Mask, Modifiers::LADDER)) {
         this->velocity.x = std::clamp(this->velocity.x, 0.15, -0.15);
         this->velocity.z = std::clamp(this->velocity.z, 0.15, -0.15);
     }
 
     m_previouslySprinting = isSprinting;
     m_previouslySneaking = isSneaking;
-    m_previouslyInWeb = this->hasModifier(Modifiers::WEB);
+    m_previouslyInWeb = includes(Mask, Modifiers::WEB);
     m_lastTurn = rotation - m_lastRotation;
     m_lastRotation = rotation;
+    if (recorder) recorder->record(*this, tickState);
+}
+
+const std::array<std::array<Player::UpdateKernel, Player::MODIFIER_COMBINATIONS>, Player::VERSIONS>
+    Player::UPDATE_KERNELS = {
+        Player::updateKernels<Version::V1_8>(std::make_index_sequence<Player::MODIFIER_COMBINATIONS>()),
+        Player::updateKernels<Version::V1_12>(std::make_index_sequence<Player::MODIFIER_COMBINATIONS>()),
+        Player::updateKernels<Version::V1_14>(std::make_index_sequence<Player::MODIFIER_COMBINATIONS>()),
+};
+
+std::optional<Player::Version> Player::findVersion(std::string_view name) {
+    if (name == "1.8") return Version::V1_8;
+    if (name == "1.12") return Version::V1_12;
+    if (name == "1.14") return Version::V1_14;
+    return std::nullopt;
 }
 
 std::ostream& operator<<(std::ostream& os, const Player& p) {
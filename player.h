@@ -8,26 +8,54 @@
 #include <cstdint>
 #include <optional>
 #include <ostream>
-#include <queue>
-#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 #include "vector.h"
 
+class Recorder;
+
 constexpr double PI = 3.14159265358979323846;
-inline std::array<float, 65536> makeSinTable() {
-    std::array<float, 65536> table{};
+enum class State { JUMPING, GROUNDED, AIRBORNE };
+// Movement keys, one bit each. The keys held are a mask of them.
+enum class Key : uint8_t { W = 1, A = 1 << 1, S = 1 << 2, D = 1 << 3 };
 
-    for (size_t i = 0; i < table.size(); i++) {
-        table[i] = static_cast<float>(std::sin(PI * 2.0 * i / 65536.0));
-    }
-    return table;
+// The mask for keys written like "wa", other characters are ignored.
+constexpr uint8_t keyMask(std::string_view inputs) {
+    uint8_t keys = 0;
+    for (char key : inputs) {
+        if (key == 'w') keys |= static_cast<uint8_t>(Key::W);
+        if (key == 'a') keys |= static_cast<uint8_t>(Key::A);
+        if (key == 's') keys |= static_cast<uint8_t>(Key::S);
+        if (key == 'd') keys |= static_cast<uint8_t>(Key::D);
+    }
+    return keys;
 }
-enum class State { JUMPING, GROUNDED, AIRBORNE };
+
+// Forward and strafe input for every mask, W wins over S and A over D.
+inline constexpr std::array<Vector2<float>, 16> MOVEMENT_VALUES = [] {
+    std::array<Vector2<float>, 16> values;
+    for (uint8_t keys = 0; keys < 16; keys++) {
+        if (keys & static_cast<uint8_t>(Key::W)) {
+            values[keys].x = 1.0f;
+        } else if (keys & static_cast<uint8_t>(Key::S)) {
+            values[keys].x = -1.0f;
+        }
+        if (keys & static_cast<uint8_t>(Key::A)) {
+            values[keys].z = 1.0f;
+        } else if (keys & static_cast<uint8_t>(Key::D)) {
+            values[keys].z = -1.0f;
+        }
+    }
+    return values;
+}();
 
 class Player {
-   private:
-    inline static const std::array<float, 65536> SIN_TABLE = makeSinTable();
-    State m_state = State::JUMPING;
+    friend class PlayerBatch;
+
+   public:
+    // What the player moves through or stands on, set by every movement, see the [name] modifiers of scripts.
     enum class Modifiers : u_int32_t {
         NONE = 0,
         WATER = 1,
@@ -37,18 +65,56 @@ class Player {
         LADDER = 1 << 4,
         SOULSAND = 1 << 5
     };
-    const float m_sprintjumpBoost = 0.2f;
-    const float m_inertiaThreshold = 0.005;
+    static constexpr size_t MODIFIER_COMBINATIONS = 1 << 6;
+    // Game versions whose movement differs, see the version builtin of scripts. 1.14 stands for 1.14 and later.
+    enum class Version : uint8_t { V1_8, V1_12, V1_14 };
+    static constexpr size_t VERSIONS = 3;
+    // What changed between versions. update() and repeat() are instantiated per version, so they test none of it.
+    struct Rules {
+        // In the air, the sprint multiplier applies when the previous tick sprinted, not this one.
+        bool airSprintDelay;
+        // Sneaking slows the player from the tick after it starts.
+        bool sneakDelay;
+        // Velocity components smaller than this are zeroed at the start of a tick.
+        float inertiaThreshold;
+    };
+    static constexpr std::array<Rules, VERSIONS> VERSION_RULES = {{
+        {true, false, 0.005f},
+        {true, false, 0.003f},
+        {true, true, 0.003f},
+    }};
+    static constexpr Rules rulesOf(Version version) { return VERSION_RULES[static_cast<size_t>(version)]; }
+
+   private:
+    // Generated at build time by sintable_gen.cpp, so it is constant initialized instead of filled on startup.
+    static const std::array<float, 65536> SIN_TABLE;
+    State m_state = State::JUMPING;
+    static constexpr float m_sprintjumpBoost = 0.2f;
     float m_defaultGroundSlipperiness = 0.6f;
     float m_rotation = 0.0f;
     float m_lastRotation = 0.0f;
     float m_lastTurn = 0.0f;
     // TODO: add angle queue, and turn queue
-    std::queue<float> m_angles;
-    bool m_airSprintDelay = true;
-    bool m_sneakDelay = false;
-    int8_t m_inertiaAxis = 1;
-    // TODO: add record, history, macros, and record inertia
+    // Fixed capacity, so that Player stays trivially copyable.
+    struct AngleQueue {
+        std::array<float, 16> angles{};
+        uint8_t head = 0;
+        uint8_t count = 0;
+        bool empty() const { return count == 0; }
+        float front() const { return angles[head]; }
+        void pop() {
+            head = (head + 1) % angles.size();
+            count--;
+        }
+        bool push(float angle) {
+            if (count == angles.size()) return false;
+            angles[(head + count++) % angles.size()] = angle;
+            return true;
+        }
+    };
+    AngleQueue m_angles;
+    Version m_version = Version::V1_8;
+    // TODO: add macros, and record inertia
     int16_t m_speedEffect = 0;
     int16_t m_slowEffect = 0;
     Modifiers m_modifiers = Modifiers::NONE;
@@ -59,69 +125,83 @@ class Player {
     bool m_previouslySprinting = false;
 
    private:
+    // Calls `f` with the player's version as a std::integral_constant, so it can instantiate templates on it.
+    template <typename F>
+    decltype(auto) withVersion(F&& f) const {
+        switch (m_version) {
+            case Version::V1_12:
+                return f(std::integral_constant<Version, Version::V1_12>());
+            case Version::V1_14:
+                return f(std::integral_constant<Version, Version::V1_14>());
+            default:
+                return f(std::integral_constant<Version, Version::V1_8>());
+        }
+    }
+    template <Version V>
+    void move(int duration, bool overrideRotation, float rotation, float rotationOffset, float slipperiness,
+              bool isSprinting, bool isSneaking, int speed, int slow);
+    // One tick with the rules of `V` and the modifiers in `Mask`. Neither can change during a move, so move() picks
+    // the kernel for them from UPDATE_KERNELS once and its ticks don't test them.
+    template <Version V, u_int32_t Mask>
     void update(bool overrideRotation, float rotationOffset, bool isSprinting, bool isSneaking, float& slipperiness,
                 float rotation, int speed, int slow, float sprintjumpBoost);
-    bool hasModifier(Modifiers modifier) {
-        return static_cast<u_int32_t>(m_modifiers) & static_cast<u_int32_t>(modifier);
+    using UpdateKernel = void (Player::*)(bool, float, bool, bool, float&, float, int, int, float);
+    template <Version V, size_t... Masks>
+    static constexpr std::array<UpdateKernel, sizeof...(Masks)> updateKernels(std::index_sequence<Masks...>) {
+        return {&Player::update<V, Masks>...};
+    }
+    // update() for every version and combination of modifiers, by version and mask.
+    static const std::array<std::array<UpdateKernel, MODIFIER_COMBINATIONS>, VERSIONS> UPDATE_KERNELS;
+    template <Version V>
+    void repeat(int ticks, bool overrideRotation, float rotationOffset, bool isSprinting, bool isSneaking,
+                float slipperiness, float rotation, int speed, int slow);
+    // Whether a tick moves sneaking, with the sneak delay of `rules`.
+    bool sneaking(const Rules& rules, bool isSneaking) const {
+        return rules.sneakDelay ? m_previouslySneaking : isSneaking;
+    }
+    bool hasModifier(Modifiers modifier) const { return includes(static_cast<u_int32_t>(m_modifiers), modifier); }
+    static constexpr bool includes(u_int32_t mask, Modifiers modifier) {
+        return mask & static_cast<u_int32_t>(modifier);
     }
 
     // x: forward, z: strafe
-    Vector2<float> movementValues() {
-        Vector2<float> movement{0.0f, 0.0f};
-        if (inputs.find("w") != inputs.npos) {
-            movement.x = 1.0f;
-        } else if (inputs.find("s") != inputs.npos) {
-            movement.x = -1.0f;
-        }
-        if (inputs.find("a") != inputs.npos) {
-            movement.z = 1.0f;
-        } else if (inputs.find("d") != inputs.npos) {
-            movement.z = -1.0f;
-        }
+    Vector2<float> movementValues() const {
+        Vector2<float> movement = MOVEMENT_VALUES[keys & 15];
         if (this->m_reverse) {
             movement.scale(-1.0f);
         }
         return movement;
     }
     float getMovementMultiplier(float slipperiness, bool isSprinting, int16_t speed, int16_t slow);
-    float getOptimalStrafeJumpAngle(std::optional<int> speed, std::optional<int> slow,
-                                    std::optional<float> slipperiness, bool isSneaking) {
-        Player playerCopy = *this;
-        playerCopy.position.x = 0.0;
-        playerCopy.position.z = 0.0;
-        playerCopy.velocity.x = 0.0;
-        playerCopy.velocity.z = 0.0;
-        playerCopy.m_rotation = 0.0f;
-        if (speed.has_value()) {
-            playerCopy.m_speedEffect = speed.value();
-        }
-        if (slow.has_value()) {
-            playerCopy.m_slowEffect = slow.value();
-        }
-        if (slipperiness.has_value()) {
-            playerCopy.m_defaultGroundSlipperiness = slipperiness.value();
-        }
-        playerCopy.inputs = "";
-        if (isSneaking) {
-            playerCopy.sneaksprintjump(1, std::nullopt, std::nullopt, std::nullopt, std::nullopt);
-        } else {
-            playerCopy.sprintjump(1, std::nullopt, std::nullopt, std::nullopt, std::nullopt);
-        }
-        return std::fabs(180.0 * std::atan2(playerCopy.velocity.x, playerCopy.velocity.z) / PI);
-    }
+    // getMovementMultiplier out of water and lava.
+    template <Version V>
+    float getLandMultiplier(float slipperiness, bool isSprinting, int16_t speed, int16_t slow);
+    // Memoized per thread, the probe only depends on the facing and a few flags.
+    float getOptimalStrafeJumpAngle(bool isSneaking) const;
+    static float probeStrafeJumpAngle(float rotation, uint64_t probe);
 
-    float mcsin(float radians) {
+    static float mcsin(float radians) {
         // 10430.378f comes from 65536 / (2.0 * PI)
         return SIN_TABLE[static_cast<int>(radians * 10430.378f) & 0xffff];
     }
 
-    float mccos(float radians) { return SIN_TABLE[static_cast<int>(radians * 10430.378f + 16384.0f) & 0xffff]; }
+    static float mccos(float radians) { return SIN_TABLE[static_cast<int>(radians * 10430.378f + 16384.0f) & 0xffff]; }
 
    public:
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
     Vector2<double> position = {0.0, 0.0};
     Vector2<double> velocity = {0.0, 0.0};
-    std::string inputs;
+    // Key bits, see keyMask().
+    uint8_t keys = 0;
+    // Runs every tick of a move through update(), never the repeated tick shortcut. The reference the faster paths
+    // are checked against.
     bool stepExecution = false;
+    // Gets every tick while set. Recording also takes every tick through update().
+    Recorder* recorder = nullptr;
     int precision = 7;
 
    public:
@@ -137,6 +217,23 @@ class Player {
         return m_rotation;
     }
     void face(float angle) { m_rotation = angle; }
+    float rotation() const { return m_rotation; }
+    State state() const { return m_state; }
+    // The facing the last tick moved in, offset included.
+    float lastRotation() const { return m_lastRotation; }
+    // How far lastRotation() turned on the last tick.
+    float lastTurn() const { return m_lastTurn; }
+    Modifiers modifiers() const { return m_modifiers; }
+    void setModifiers(Modifiers modifiers) { m_modifiers = modifiers; }
+    Version version() const { return m_version; }
+    void setVersion(Version version) { m_version = version; }
+    // The version written like "1.12", nothing for versions the simulator doesn't know.
+    static std::optional<Version> findVersion(std::string_view name);
+    // The most one tick of a movement with these flags can add to either velocity component, whatever the state and
+    // sprint delay. Infinite when modifiers or slipperiness could also speed the player up.
+    float accelerationBound(std::optional<float> slipperiness, bool isSprinting, bool jumps) const;
+    // Strafe jump angle lookups on the calling thread so far.
+    static CacheStats strafeAngleCacheStats();
 
     void walk(int duration = 1, std::optional<float> rotation = std::nullopt,
               std::optional<float> slipperiness = std::nullopt, std::optional<int> speed = std::nullopt,
@@ -198,10 +295,10 @@ class Player {
             if (delay > duration) {
                 delay = duration;
             }
-            std::string input = this->inputs;
-            this->inputs = "";
+            uint8_t input = this->keys;
+            this->keys = 0;
             this->stopjump(delay, slipperiness);
-            this->inputs = input;
+            this->keys = input;
             this->walkair(duration - delay, rotation);
         }
     }
@@ -214,10 +311,10 @@ class Player {
             if (delay > duration) {
                 delay = duration;
             }
-            std::string input = this->inputs;
-            this->inputs = "";
+            uint8_t input = this->keys;
+            this->keys = 0;
             this->stopjump(delay, slipperiness);
-            this->inputs = input;
+            this->keys = input;
             this->walkair45(duration - delay, rotation);
         }
     }
@@ -238,11 +335,11 @@ class Player {
                           std::optional<float> slipperiness = std::nullopt, std::optional<int> speed = std::nullopt,
                           std::optional<int> slow = std::nullopt) {
         if (duration > 0) {
-            this->inputs = "wa";
-            this->move(1, rotation, this->getOptimalStrafeJumpAngle(speed, slow, slipperiness, false), slipperiness,
+            this->keys = keyMask("wa");
+            this->move(1, rotation, this->getOptimalStrafeJumpAngle(false), slipperiness,
                        true, false, speed, slow,
                        State::JUMPING);  // TODO: This again
-            this->inputs = "w";
+            this->keys = keyMask("w");
             this->sprintair(duration - 1, rotation);
         }
     }
@@ -250,8 +347,8 @@ class Player {
                             std::optional<float> slipperiness = std::nullopt, std::optional<int> speed = std::nullopt,
                             std::optional<int> slow = std::nullopt) {
         if (duration > 0) {
-            this->inputs = "wa";
-            this->move(1, rotation, this->getOptimalStrafeJumpAngle(speed, slow, slipperiness, false), slipperiness,
+            this->keys = keyMask("wa");
+            this->move(1, rotation, this->getOptimalStrafeJumpAngle(false), slipperiness,
                        true, false, speed, slow,
                        State::JUMPING);  // TODO: Check what boolean is for and
                                          // getOptimalStrafeJumpAngle implementation
@@ -266,10 +363,10 @@ class Player {
             if (delay > duration) {
                 delay = duration;
             }
-            std::string input = this->inputs;
-            this->inputs = "";
+            uint8_t input = this->keys;
+            this->keys = 0;
             this->stopjump(delay, slipperiness);
-            this->inputs = input;
+            this->keys = input;
             this->sprintair(duration - delay, rotation);
         }
     }
@@ -281,10 +378,10 @@ class Player {
             if (delay > duration) {
                 delay = duration;
             }
-            std::string input = this->inputs;
-            this->inputs = "";
+            uint8_t input = this->keys;
+            this->keys = 0;
             this->stopjump(delay, slipperiness);
-            this->inputs = input;
+            this->keys = input;
             this->sprintair45(duration - delay, rotation);
         }
     }
@@ -388,12 +485,15 @@ class Player {
                            std::optional<float> slipperiness = std::nullopt, std::optional<int> speed = std::nullopt,
                            std::optional<int> slow = std::nullopt) {
         if (duration > 0) {
-            this->inputs = "wa";
-            this->move(1, rotation, this->getOptimalStrafeJumpAngle(speed, slow, slipperiness, true), slipperiness,
+            this->keys = keyMask("wa");
+            this->move(1, rotation, this->getOptimalStrafeJumpAngle(true), slipperiness,
                        true, true, speed, slow, State::JUMPING);
             this->sneaksprintair45(duration - 1, rotation);
         }
     }
 };
 
+// Copied wholesale by optimize workers and PlayerBatch.
+static_assert(std::is_trivially_copyable_v<Player>);
+
 std::ostream& operator<<(std::ostream& os, const Player& p);
@@ -0,0 +1,267 @@
+#include "playerbatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+PlayerBatch::PlayerBatch(const Player& prototype, size_t size)
+    : m_prototype(prototype),
+      m_rotation(size),
+      m_lastRotation(size),
+      m_lastTurn(size),
+      m_previousSlipperiness(size),
+      m_state(size),
+      m_flags(size),
+      positionX(size),
+      positionZ(size),
+      velocityX(size),
+      velocityZ(size),
+      keys(prototype.keys) {
+    for (size_t lane = 0; lane < size; lane++) load(lane, prototype);
+}
+
+void PlayerBatch::load(size_t lane, const Player& player) {
+    positionX[lane] = player.position.x;
+    positionZ[lane] = player.position.z;
+    velocityX[lane] = player.velocity.x;
+    velocityZ[lane] = player.velocity.z;
+    m_rotation[lane] = player.m_rotation;
+    m_lastRotation[lane] = player.m_lastRotation;
+    m_lastTurn[lane] = player.m_lastTurn;
+    m_previousSlipperiness[lane] = player.m_previousSlipperiness;
+    m_state[lane] = player.m_state;
+    m_flags[lane] = (player.m_previouslySprinting ? PREVIOUSLY_SPRINTING : 0) |
+                    (player.m_previouslySneaking ? PREVIOUSLY_SNEAKING : 0) |
+                    (player.m_previouslyInWeb ? PREVIOUSLY_IN_WEB : 0);
+}
+
+void PlayerBatch::store(size_t lane, Player& player) const {
+    player.position = {positionX[lane], positionZ[lane]};
+    player.velocity = {velocityX[lane], velocityZ[lane]};
+    player.keys = keys;
+    player.m_rotation = m_rotation[lane];
+    player.m_lastRotation = m_lastRotation[lane];
+    player.m_lastTurn = m_lastTurn[lane];
+    player.m_previousSlipperiness = m_previousSlipperiness[lane];
+    player.m_state = m_state[lane];
+    player.m_previouslySprinting = m_flags[lane] & PREVIOUSLY_SPRINTING;
+    player.m_previouslySneaking = m_flags[lane] & PREVIOUSLY_SNEAKING;
+    player.m_previouslyInWeb = m_flags[lane] & PREVIOUSLY_IN_WEB;
+}
+
+void PlayerBatch::truncate(size_t size) {
+    size = std::min(size, this->size());
+    for (std::vector<float>* lanes : {&m_rotation, &m_lastRotation, &m_lastTurn, &m_previousSlipperiness}) {
+        lanes->resize(size);
+    }
+    for (std::vector<double>* lanes : {&positionX, &positionZ, &velocityX, &velocityZ}) lanes->resize(size);
+    m_state.resize(size);
+    m_flags.resize(size);
+}
+
+void PlayerBatch::move(int duration, std::optional<float> rotation, float rotationOffset,
+                       std::optional<float> slipperiness, bool isSprinting, bool isSneaking, std::optional<int> speed,
+                       std::optional<int> slow, State state) {
+    Player& p = m_prototype;
+    Tick tick{};
+    tick.state = state;
+    tick.overrideRotation = rotation.has_value();
+    tick.rotation = rotation.has_value() ? rotation.value() + rotationOffset : 0.0f;
+    tick.rotationOffset = rotationOffset;
+    tick.isSprinting = isSprinting;
+    tick.isSneaking = isSneaking;
+    tick.slipperiness = slipperiness.value_or(p.m_defaultGroundSlipperiness);
+    tick.rules = Player::rulesOf(p.m_version);
+    tick.lava = p.hasModifier(Player::Modifiers::LAVA);
+    tick.fluid = p.hasModifier(Player::Modifiers::WATER) || tick.lava;
+    tick.soulsand = p.hasModifier(Player::Modifiers::SOULSAND);
+    tick.web = p.hasModifier(Player::Modifiers::WEB);
+    tick.ladder = p.hasModifier(Player::Modifiers::LADDER);
+    tick.repeats = !tick.soulsand && !tick.web && !tick.ladder;
+    if (p.hasModifier(Player::Modifiers::WATER)) {
+        tick.slipperiness = 0.8f / 0.91f;
+    } else if (tick.lava) {
+        tick.slipperiness = 0.5f / 0.91f;
+    }
+
+    if (rotationOffset == 45) keys = keyMask("wa");
+    p.keys = keys;
+    tick.direction = p.movementValues();
+    if (p.hasModifier(Player::Modifiers::BLOCK)) tick.direction.scale(0.2f);
+    tick.sneakingDirection = tick.direction;
+    tick.sneakingDirection.scale(0.3f);
+    tick.direction.scale(0.98f);
+    tick.sneakingDirection.scale(0.98f);
+
+    // The ground multiplier only depends on the move, the state of each lane picks it or one of the air constants.
+    p.m_state = State::GROUNDED;
+    tick.groundMultiplier =
+        p.getMovementMultiplier(tick.slipperiness, isSprinting, static_cast<int16_t>(speed.value_or(p.m_speedEffect)),
+                                static_cast<int16_t>(slow.value_or(p.m_slowEffect)));
+    tick.sprintjumpBoost = p.m_reverse ? -p.m_sprintjumpBoost : p.m_sprintjumpBoost;
+
+    const KernelInfo& info = tick.ladder ? KernelInfo{&PlayerBatch::advance, 1, "scalar"} : kernel();
+    size_t lane = 0;
+    for (; lane + info.width <= size(); lane += info.width) {
+        if (isUniform(lane, info.width)) {
+            (this->*info.kernel)(lane, duration, tick);
+        } else {
+            for (size_t i = lane; i < lane + info.width; i++) advance(i, duration, tick);
+        }
+    }
+    for (; lane < size(); lane++) advance(lane, duration, tick);
+
+    // The facing of the last tick and the turn into it, as update() leaves them. Only the first tick turns.
+    for (size_t i = 0; duration > 0 && i < size(); i++) {
+        float rotation = tick.overrideRotation ? tick.rotation : m_rotation[i] + tick.rotationOffset;
+        m_lastTurn[i] = duration > 1 ? rotation - rotation : rotation - m_lastRotation[i];
+        m_lastRotation[i] = rotation;
+    }
+}
+
+bool PlayerBatch::isUniform(size_t lane, size_t width) const {
+    for (size_t i = lane + 1; i < lane + width; i++) {
+        if (m_flags[i] != m_flags[lane] ||
+            std::memcmp(&m_previousSlipperiness[i], &m_previousSlipperiness[lane], sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PlayerBatch::sneaking(uint8_t flags, const Tick& tick) const {
+    return tick.rules.sneakDelay ? (flags & PREVIOUSLY_SNEAKING) : tick.isSneaking;
+}
+
+// The input direction scaled by the movement multiplier, or nothing when no key is held.
+std::optional<Vector2<float>> PlayerBatch::acceleration(State state, uint8_t flags, const Tick& tick) const {
+    Vector2<float> direction = sneaking(flags, tick) ? tick.sneakingDirection : tick.direction;
+    float distance = direction.sqrMagnitude();
+    if (!(distance > 0.0f)) return std::nullopt;
+
+    float multiplier = tick.groundMultiplier;
+    if (tick.fluid) {
+        multiplier = 0.02f;
+    } else if (state == State::AIRBORNE) {
+        bool sprinting = tick.rules.airSprintDelay ? (flags & PREVIOUSLY_SPRINTING) : tick.isSprinting;
+        multiplier = sprinting ? 0.02f + 0.02f * 0.3f : 0.02f;
+    }
+    distance = std::sqrt(distance);
+    distance = std::max(distance, 1.0f);
+    distance = multiplier / distance;
+    direction.scale(distance);
+    return direction;
+}
+
+uint8_t PlayerBatch::nextFlags(const Tick& tick) {
+    return (tick.isSprinting ? PREVIOUSLY_SPRINTING : 0) | (tick.isSneaking ? PREVIOUSLY_SNEAKING : 0) |
+           (tick.web ? PREVIOUSLY_IN_WEB : 0);
+}
+
+// Player::move and Player::update for a single lane, with the lane's state held in locals across ticks.
+void PlayerBatch::advance(size_t lane, int duration, const Tick& tick) {
+    Player& p = m_prototype;
+    double x = positionX[lane], z = positionZ[lane];
+    double vx = velocityX[lane], vz = velocityZ[lane];
+    float previousSlipperiness = m_previousSlipperiness[lane];
+    float slipperiness = tick.slipperiness;
+    uint8_t flags = m_flags[lane];
+    State state = tick.state;
+    float rotation = tick.overrideRotation ? tick.rotation : m_rotation[lane] + tick.rotationOffset;
+    if (sneaking(flags, tick) && tick.lava) state = State::AIRBORNE;
+
+    int i = 0;
+    for (; i < duration; i++) {
+        // One tick in, the flags are those of this move. Once the jump is over and the slipperiness has caught up,
+        // the rest is the loop below.
+        if (i > 0 && tick.repeats && state != State::JUMPING && previousSlipperiness == slipperiness) break;
+
+        x += vx;
+        z += vz;
+
+        if (tick.soulsand) {
+            vx *= 0.4;
+            vz *= 0.4;
+        }
+
+        double friction = 0.91 * previousSlipperiness;
+        vx *= friction;
+        vz *= friction;
+
+        if (std::fabs(vx) < tick.rules.inertiaThreshold || (flags & PREVIOUSLY_IN_WEB)) vx = 0.0f;
+        if (std::fabs(vz) < tick.rules.inertiaThreshold || (flags & PREVIOUSLY_IN_WEB)) vz = 0.0f;
+
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        previousSlipperiness = slipperiness;
+
+        if (state == State::JUMPING) {
+            state = State::AIRBORNE;
+            slipperiness = 1.0f;
+            if (tick.isSprinting) {
+                float facing = rotation * 0.017453292f;
+                vx -= double(p.mcsin(facing) * tick.sprintjumpBoost);
+                vz += double(p.mccos(facing) * tick.sprintjumpBoost);
+            }
+        }
+
+        if (acceleration.has_value()) {
+            auto [forward, strafe] = acceleration.value();
+            float sinYaw = p.mcsin(rotation * PI / 180.0f);
+            float cosYaw = p.mccos(rotation * PI / 180.0f);
+            vx += strafe * cosYaw - forward * sinYaw;
+            vz += forward * cosYaw + strafe * sinYaw;
+        }
+
+        if (tick.web) {
+            vx *= 0.25f;
+            vz *= 0.25f;
+        }
+        if (tick.ladder) {
+            vx = std::clamp(vx, 0.15, -0.15);
+            vz = std::clamp(vz, 0.15, -0.15);
+        }
+
+        flags = nextFlags(tick);
+    }
+
+    // Like Player::repeat, with the acceleration and the branches on the move hoisted out of the identical ticks.
+    if (i < duration) {
+        double friction = 0.91 * previousSlipperiness;
+        double threshold = tick.rules.inertiaThreshold;
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        if (acceleration.has_value()) {
+            auto [forward, strafe] = acceleration.value();
+            float sinYaw = p.mcsin(rotation * PI / 180.0f);
+            float cosYaw = p.mccos(rotation * PI / 180.0f);
+            float accelerationX = strafe * cosYaw - forward * sinYaw;
+            float accelerationZ = forward * cosYaw + strafe * sinYaw;
+            for (; i < duration; i++) {
+                x += vx;
+                z += vz;
+                vx *= friction;
+                vz *= friction;
+                if (std::fabs(vx) < threshold) vx = 0.0f;
+                if (std::fabs(vz) < threshold) vz = 0.0f;
+                vx += accelerationX;
+                vz += accelerationZ;
+            }
+        } else {
+            for (; i < duration; i++) {
+                x += vx;
+                z += vz;
+                vx *= friction;
+                vz *= friction;
+                if (std::fabs(vx) < threshold) vx = 0.0f;
+                if (std::fabs(vz) < threshold) vz = 0.0f;
+            }
+        }
+    }
+
+    positionX[lane] = x;
+    positionZ[lane] = z;
+    velocityX[lane] = vx;
+    velocityZ[lane] = vz;
+    m_previousSlipperiness[lane] = previousSlipperiness;
+    m_state[lane] = state;
+    m_flags[lane] = flags;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "player.h"
+
+// Advances many players through the same movement sequence, e.g. one per candidate facing of a setup search.
+//
+// Every lane computes exactly what Player::update would. Per lane state lives in parallel arrays, the configuration a
+// script can't vary between lanes (effects, modifiers, inputs, version) is taken from the prototype player once.
+class PlayerBatch {
+   private:
+    enum Flags : uint8_t { PREVIOUSLY_SPRINTING = 1, PREVIOUSLY_SNEAKING = 1 << 1, PREVIOUSLY_IN_WEB = 1 << 2 };
+
+    // Everything update() derives from the arguments of a move, identical for all lanes.
+    struct Tick {
+        State state;
+        bool overrideRotation;
+        float rotation;
+        float rotationOffset;
+        bool isSprinting;
+        bool isSneaking;
+        float slipperiness;
+        float groundMultiplier;
+        float sprintjumpBoost;
+        Vector2<float> direction;
+        Vector2<float> sneakingDirection;
+        bool fluid;
+        bool lava;
+        bool soulsand;
+        bool web;
+        bool ladder;
+        // No modifier touches the velocity between ticks, so once the flags and slipperiness have settled every
+        // further tick is the same.
+        bool repeats;
+        Player::Rules rules;
+    };
+
+    Player m_prototype;
+    std::vector<float> m_rotation;
+    std::vector<float> m_lastRotation;
+    std::vector<float> m_lastTurn;
+    std::vector<float> m_previousSlipperiness;
+    std::vector<State> m_state;
+    std::vector<uint8_t> m_flags;
+
+    // Advances `width` lanes from `lane` whose flags and previous slipperiness are all equal.
+    using Kernel = void (PlayerBatch::*)(size_t lane, int duration, const Tick& tick);
+    struct KernelInfo {
+        Kernel kernel;
+        size_t width;
+        const char* name;
+    };
+
+   private:
+    bool sneaking(uint8_t flags, const Tick& tick) const;
+    std::optional<Vector2<float>> acceleration(State state, uint8_t flags, const Tick& tick) const;
+    static uint8_t nextFlags(const Tick& tick);
+    bool isUniform(size_t lane, size_t width) const;
+    void advance(size_t lane, int duration, const Tick& tick);
+    void advanceSse2(size_t lane, int duration, const Tick& tick);
+    void advanceAvx2(size_t lane, int duration, const Tick& tick);
+    static KernelInfo& kernel();
+
+   public:
+    std::vector<double> positionX;
+    std::vector<double> positionZ;
+    std::vector<double> velocityX;
+    std::vector<double> velocityZ;
+    uint8_t keys;
+
+   public:
+    PlayerBatch(const Player& prototype, size_t size);
+
+    size_t size() const { return positionX.size(); }
+    void load(size_t lane, const Player& player);
+    void store(size_t lane, Player& player) const;
+    void face(size_t lane, float angle) { m_rotation[lane] = angle; }
+    // Drops the lanes from `size` on.
+    void truncate(size_t size);
+    // For every lane, like Player::setModifiers.
+    void setModifiers(Player::Modifiers modifiers) { m_prototype.setModifiers(modifiers); }
+    // The tick kernel picked for this CPU, "scalar", "sse2" or "avx2".
+    static const char* kernelName() { return kernel().name; }
+    // Makes every batch use the named kernel from now on, false when this CPU can't run it. Lets the kernels be
+    // checked against each other on one machine. Not thread safe, call it before any batch moves.
+    static bool useKernel(std::string_view name);
+
+    void move(int duration, std::optional<float> rotation, float rotationOffset, std::optional<float> slipperiness,
+              bool isSprinting, bool isSneaking, std::optional<int> speed, std::optional<int> slow, State state);
+};
@@ -0,0 +1,18 @@
+#include "recorder.h"
+
+void Recorder::start(size_t capacity) {
+    positionX.assign(capacity, 0.0);
+    positionZ.assign(capacity, 0.0);
+    velocityX.assign(capacity, 0.0);
+    velocityZ.assign(capacity, 0.0);
+    rotation.assign(capacity, 0.0f);
+    state.assign(capacity, 0);
+    keys.assign(capacity, 0);
+    m_next = 0;
+    m_recorded = 0;
+}
+
+Recorder::Tick Recorder::operator[](size_t index) const {
+    size_t i = column(index);
+    return {positionX[i], positionZ[i], velocityX[i], velocityZ[i], rotation[i], static_cast<State>(state[i]), keys[i]};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "player.h"
+
+// Every tick of the players it is attached to, see Player::recorder. Ticks are kept in parallel columns allocated once
+// by start(), so recording doesn't allocate. When more ticks than fit have been recorded the oldest are overwritten.
+class Recorder {
+   public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    struct Tick {
+        double x, z, vx, vz;
+        float rotation;
+        State state;
+        uint8_t keys;
+    };
+
+   private:
+    // Where the next tick goes.
+    size_t m_next = 0;
+    uint64_t m_recorded = 0;
+
+   public:
+    // Position and velocity after the tick, the facing and keys it moved with and the state it started in.
+    std::vector<double> positionX;
+    std::vector<double> positionZ;
+    std::vector<double> velocityX;
+    std::vector<double> velocityZ;
+    std::vector<float> rotation;
+    // State values.
+    std::vector<uint8_t> state;
+    std::vector<uint8_t> keys;
+
+   public:
+    // Forgets what was recorded and makes room for `capacity` ticks.
+    void start(size_t capacity);
+
+    void record(const Player& player, State tickState) {
+        positionX[m_next] = player.position.x;
+        positionZ[m_next] = player.position.z;
+        velocityX[m_next] = player.velocity.x;
+        velocityZ[m_next] = player.velocity.z;
+        rotation[m_next] = player.lastRotation();
+        state[m_next] = static_cast<uint8_t>(tickState);
+        keys[m_next] = player.keys;
+        if (++m_next == capacity()) m_next = 0;
+        m_recorded++;
+    }
+
+    size_t capacity() const { return positionX.size(); }
+    // Ticks kept, at most the capacity.
+    size_t size() const { return m_recorded < capacity() ? m_recorded : capacity(); }
+    // Ticks recorded since start(), the first tick kept is number recorded() - size() + 1.
+    uint64_t recorded() const { return m_recorded; }
+    // Column index of the `index`th oldest tick kept. The kept ticks are the columns from first() to the end, then
+    // from 0, until size() ticks.
+    size_t first() const { return m_recorded < capacity() ? 0 : m_next; }
+    size_t column(size_t index) const { return (first() + index) % capacity(); }
+    Tick operator[](size_t index) const;
+};
@@ -0,0 +1,485 @@
+#include "search.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <string_view>
+
+#include "playerbatch.h"
+#include "threadpool.h"
+
+namespace {
+// The value of a literal, nothing for anything else.
+std::optional<Value> literalValue(const Expr* expr) {
+    auto* literal = dynamic_cast<const LiteralExpr*>(expr);
+    if (!literal || !literal->valid) return std::nullopt;
+    return literal->evaluate();
+}
+
+// A number as a float, the way builtins and rotations take it.
+std::optional<float> numberOf(const Value& value) {
+    if (const int* integer = std::get_if<int>(&value)) return static_cast<float>(*integer);
+    if (const float* floating = std::get_if<float>(&value)) return *floating;
+    return std::nullopt;
+}
+
+// Durations are converted like the interpreters do, a float is truncated.
+int durationOf(const Value& value) {
+    if (const int* integer = std::get_if<int>(&value)) return *integer;
+    return static_cast<int>(std::get<float>(value));
+}
+
+// The parameter `expr` is, if it is one.
+std::optional<size_t> parameterOf(const Expr* expr, const OptimizeStmt& stmt) {
+    auto* var = dynamic_cast<const VarExpr*>(expr);
+    if (!var || var->field.has_value()) return std::nullopt;
+    for (size_t i = 0; i < stmt.parameters.size(); i++) {
+        if (stmt.parameters[i].identifier == var->identifier) return i;
+    }
+    return std::nullopt;
+}
+
+std::optional<Field> fieldOf(const Expr* expr) {
+    auto* var = dynamic_cast<const VarExpr*>(expr);
+    return var ? var->field : std::nullopt;
+}
+
+bool addStages(const Stmt* stmt, const OptimizeStmt& optimize,
+               const std::function<bool(const CallExpr&)>& isFunction, SearchPlan& plan) {
+    if (auto* block = dynamic_cast<const BlockStmt*>(stmt)) {
+        if (block->tap) return false;
+        for (const Stmt* inner : block->statements) {
+            if (!addStages(inner, optimize, isFunction, plan)) return false;
+        }
+        return true;
+    }
+    auto* exprStmt = dynamic_cast<const ExprStmt*>(stmt);
+    auto* call = exprStmt ? dynamic_cast<const CallExpr*>(exprStmt->expression) : nullptr;
+    if (!call || isFunction(*call)) return false;
+
+    SearchPlan::Stage stage;
+    stage.builtin = call->builtin;
+    stage.movement = call->movement;
+    // In water and lava every call to Player::move sets the slipperiness again, where the ticks of one call keep what
+    // the jump left. The ticks of such a stage can't be taken one call at a time.
+    constexpr u_int32_t LIQUIDS =
+        static_cast<u_int32_t>(Player::Modifiers::WATER) | static_cast<u_int32_t>(Player::Modifiers::LAVA);
+    if (!stage.builtin.has_value() && (static_cast<u_int32_t>(stage.movement.modifiers) & LIQUIDS)) return false;
+    if (call->builtin.has_value()) {
+        switch (call->builtin.value()) {
+            case Builtin::Reset:
+                plan.stages.push_back(stage);
+                return true;
+            case Builtin::Facing:
+            case Builtin::SetX:
+            case Builtin::SetZ:
+            case Builtin::SetVX:
+            case Builtin::SetVZ:
+                break;
+            default:
+                return false;
+        }
+    }
+    bool movement = !stage.builtin.has_value();
+    for (size_t i = 0; i < call->arguments.size(); i++) {
+        const Expr* arg = call->arguments[i];
+        if (movement && i == 0) {
+            stage.parameter = parameterOf(arg, optimize);
+            if (stage.parameter.has_value()) continue;
+        }
+        std::optional<Value> value = literalValue(arg);
+        if (!value.has_value()) return false;
+        // Only the first argument of a builtin and the first two of a movement mean anything, the rest are evaluated
+        // and dropped.
+        if (i > (movement ? 1u : 0u)) continue;
+        std::optional<float> number = numberOf(value.value());
+        if (!number.has_value()) return false;
+        if (!movement) {
+            stage.value = number;
+        } else if (i == 0) {
+            stage.duration = durationOf(value.value());
+        } else {
+            stage.rotation = number.value();
+        }
+    }
+    plan.stages.push_back(stage);
+    return true;
+}
+
+double fieldValue(const Player& player, Field field) {
+    switch (field) {
+        case Field::X:
+            return player.position.x;
+        case Field::Z:
+            return player.position.z;
+        case Field::VX:
+            return player.velocity.x;
+        case Field::VZ:
+            return player.velocity.z;
+    }
+    return 0.0;
+}
+
+bool isJump(const Movement& movement) { return movement.state == State::JUMPING; }
+
+// Candidates a task of the parallel search advances together when only one parameter is searched.
+constexpr size_t BATCH_LANES = 64;
+
+class TreeSearch {
+   private:
+    const SearchPlan& m_plan;
+    const std::vector<SearchRange>& m_ranges;
+    // How far the index of a candidate moves per value of each parameter, the last one varies fastest.
+    std::vector<size_t> m_strides;
+    // From each stage to the end: the most ticks there can be, the most any of them can change a velocity component
+    // by, and whether a builtin can still put the player anywhere.
+    std::vector<int> m_ticksLeft;
+    std::vector<double> m_accelerationLeft;
+    std::vector<bool> m_teleports;
+    // The last stage with a parameter, when a movement follows it. The states after each of its durations go through
+    // the remaining stages together, in a PlayerBatch.
+    std::optional<size_t> m_batched;
+    // Shared between the workers for pruning, the best score found and with Goal::Until the lowest index.
+    std::atomic<double> m_bestScore = -std::numeric_limits<double>::infinity();
+    std::atomic<size_t> m_found = std::numeric_limits<size_t>::max();
+
+   private:
+    void perform(const SearchPlan::Stage& stage, Player& player, int duration) const {
+        if (!stage.builtin.has_value()) {
+            performMovement(player, stage.movement, duration, stage.rotation, false);
+            return;
+        }
+        // Without an argument the builtins set 0, like callBuiltin.
+        float value = stage.value.value_or(0.0f);
+        switch (stage.builtin.value()) {
+            case Builtin::Reset:
+                player.position.x = 0.0f;
+                player.position.z = 0.0f;
+                return;
+            case Builtin::Facing:
+                player.face(value);
+                return;
+            case Builtin::SetX:
+                player.position.x = value;
+                return;
+            case Builtin::SetZ:
+                player.position.z = value;
+                return;
+            case Builtin::SetVX:
+                player.velocity.x = value;
+                return;
+            case Builtin::SetVZ:
+                player.velocity.z = value;
+                return;
+            default:
+                return;
+        }
+    }
+
+    // perform() for every lane.
+    void perform(const SearchPlan::Stage& stage, PlayerBatch& batch) const {
+        if (!stage.builtin.has_value()) {
+            performMovement(batch, stage.movement, stage.duration, stage.rotation);
+            return;
+        }
+        float value = stage.value.value_or(0.0f);
+        for (size_t lane = 0; lane < batch.size(); lane++) {
+            switch (stage.builtin.value()) {
+                case Builtin::Reset:
+                    batch.positionX[lane] = 0.0f;
+                    batch.positionZ[lane] = 0.0f;
+                    break;
+                case Builtin::Facing:
+                    batch.face(lane, value);
+                    break;
+                case Builtin::SetX:
+                    batch.positionX[lane] = value;
+                    break;
+                case Builtin::SetZ:
+                    batch.positionZ[lane] = value;
+                    break;
+                case Builtin::SetVX:
+                    batch.velocityX[lane] = value;
+                    break;
+                case Builtin::SetVZ:
+                    batch.velocityZ[lane] = value;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // One more tick of a movement stage. After the first tick a jump goes on in the air, as it does in
+    // Player::move and performMovement.
+    void step(const SearchPlan::Stage& stage, Player& player, bool first) const {
+        const Movement& movement = stage.movement;
+        if (first || !isJump(movement)) {
+            performMovement(player, movement, 1, stage.rotation, false);
+        } else {
+            player.move(1, stage.rotation, movement.offset, 1.0f, movement.isSprinting, movement.isSneaking,
+                        std::nullopt, std::nullopt, State::AIRBORNE);
+        }
+    }
+
+    std::optional<double> score(const Player& player) const {
+        float value = static_cast<float>(fieldValue(player, m_plan.field));
+        if (m_plan.goal != OptimizeStmt::Goal::Until) return scoreObjective(m_plan.goal, value);
+        OptionalValue reached = m_plan.fieldFirst ? evaluateBinary(m_plan.op, value, m_plan.target)
+                                                  : evaluateBinary(m_plan.op, m_plan.target, value);
+        return reached.has_value() ? scoreObjective(m_plan.goal, reached.value()) : std::nullopt;
+    }
+
+    // Whether a candidate below `stage` from `player` could still be picked. The velocity changes by at most the
+    // acceleration bound a tick, friction only ever slows it down, which bounds where the player can get.
+    bool promising(size_t stage, const Player& player, size_t index) const {
+        if (m_plan.goal == OptimizeStmt::Goal::Until && index > m_found.load(std::memory_order_relaxed)) return false;
+        if (m_teleports[stage]) return true;
+        double ticks = m_ticksLeft[stage], acceleration = m_accelerationLeft[stage];
+        bool velocity = m_plan.field == Field::VX || m_plan.field == Field::VZ;
+        double value = fieldValue(player, m_plan.field);
+        double speed = std::fabs(m_plan.field == Field::X || m_plan.field == Field::VX ? player.velocity.x
+                                                                                       : player.velocity.z);
+        double reach = velocity ? speed + ticks * acceleration
+                                : ticks * speed + acceleration * ticks * (ticks - 1.0) / 2.0;
+        // Some room for rounding, the simulation adds in float and double.
+        reach = reach * (1.0 + 1e-6) + 1e-9;
+        double low = velocity ? -reach : value - reach, high = velocity ? reach : value + reach;
+        if (!std::isfinite(low) || !std::isfinite(high)) return true;
+
+        switch (m_plan.goal) {
+            case OptimizeStmt::Goal::Maximize:
+                return !(static_cast<float>(high) < m_bestScore.load(std::memory_order_relaxed));
+            case OptimizeStmt::Goal::Minimize:
+                return !(-static_cast<float>(low) < m_bestScore.load(std::memory_order_relaxed));
+            case OptimizeStmt::Goal::Until: {
+                // The comparisons are monotonic, the extreme the field can reach in their direction decides.
+                bool greater = m_plan.op == Operator::GreaterThan || m_plan.op == Operator::GreaterThanOrEquals;
+                float extreme = static_cast<float>(greater == m_plan.fieldFirst ? high : low);
+                OptionalValue reached = m_plan.fieldFirst ? evaluateBinary(m_plan.op, extreme, m_plan.target)
+                                                          : evaluateBinary(m_plan.op, m_plan.target, extreme);
+                return reached.has_value() && scoreObjective(m_plan.goal, reached.value()).has_value();
+            }
+        }
+        return true;
+    }
+
+    void offer(BestCandidate& best, size_t index, double score) {
+        best.offer(index, score);
+        if (m_plan.goal == OptimizeStmt::Goal::Until) {
+            size_t found = m_found.load(std::memory_order_relaxed);
+            while (index < found && !m_found.compare_exchange_weak(found, index, std::memory_order_relaxed)) {
+            }
+        } else {
+            double current = m_bestScore.load(std::memory_order_relaxed);
+            while (score > current && !m_bestScore.compare_exchange_weak(current, score, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    // The state after every value of the parameter of a stage, in order, from `player` at its start. Durations
+    // never decrease along a range, so each one goes on from the last.
+    template <typename F>
+    void eachDuration(const SearchPlan::Stage& stage, const Player& player, F each) const {
+        const SearchRange& range = m_ranges[stage.parameter.value()];
+        Player current = player;
+        int ticks = 0;
+        for (size_t i = 0; i < range.count; i++) {
+            int duration = durationOf(range.at(i));
+            if (duration <= 0) {
+                Player next = player;
+                perform(stage, next, duration);
+                each(i, next);
+                continue;
+            }
+            for (; ticks < duration; ticks++) step(stage, current, ticks == 0);
+            each(i, current);
+        }
+    }
+
+    // Runs the stages after m_batched on the first lanes of a batch, the candidates `indices`, and offers them.
+    void finish(PlayerBatch& batch, const std::vector<size_t>& indices, BestCandidate& best) {
+        if (indices.empty()) return;
+        batch.truncate(indices.size());
+        for (size_t i = m_batched.value() + 1; i < m_plan.stages.size(); i++) perform(m_plan.stages[i], batch);
+        // Only the position and velocity are scored.
+        Player leaf;
+        for (size_t lane = 0; lane < indices.size(); lane++) {
+            batch.store(lane, leaf);
+            if (std::optional<double> candidateScore = score(leaf)) offer(best, indices[lane], candidateScore.value());
+        }
+    }
+
+    void visit(size_t stage, const Player& player, size_t index, BestCandidate& best) {
+        if (stage == m_plan.stages.size()) {
+            if (std::optional<double> candidateScore = score(player)) offer(best, index, candidateScore.value());
+            return;
+        }
+        if (!promising(stage, player, index)) return;
+        const SearchPlan::Stage& current = m_plan.stages[stage];
+        if (!current.parameter.has_value()) {
+            Player next = player;
+            perform(current, next, current.duration);
+            visit(stage + 1, next, index, best);
+            return;
+        }
+        size_t stride = m_strides[current.parameter.value()];
+        if (stage != m_batched) {
+            eachDuration(current, player,
+                         [&](size_t i, const Player& next) { visit(stage + 1, next, index + i * stride, best); });
+            return;
+        }
+        PlayerBatch batch(player, m_ranges[current.parameter.value()].count);
+        std::vector<size_t> indices;
+        eachDuration(current, player, [&](size_t i, const Player& next) {
+            if (!promising(stage + 1, next, index + i * stride)) return;
+            batch.load(indices.size(), next);
+            indices.push_back(index + i * stride);
+        });
+        finish(batch, indices, best);
+    }
+
+   public:
+    TreeSearch(const SearchPlan& plan, const std::vector<SearchRange>& ranges, const Player& player)
+        : m_plan(plan),
+          m_ranges(ranges),
+          m_strides(ranges.size()),
+          m_ticksLeft(plan.stages.size() + 1),
+          m_accelerationLeft(plan.stages.size() + 1),
+          m_teleports(plan.stages.size() + 1) {
+        size_t stride = 1;
+        for (size_t i = ranges.size(); i-- > 0;) {
+            m_strides[i] = stride;
+            stride *= ranges[i].count;
+        }
+        bool laterParameter = false;
+        for (size_t i = plan.stages.size(); i-- > 0;) {
+            const SearchPlan::Stage& stage = plan.stages[i];
+            int ticks = 0;
+            double acceleration = 0.0;
+            if (!stage.builtin.has_value()) {
+                const Movement& movement = stage.movement;
+                ticks = stage.duration;
+                if (stage.parameter.has_value()) {
+                    const SearchRange& range = ranges[stage.parameter.value()];
+                    ticks = range.count > 0 ? durationOf(range.at(range.count - 1)) : 0;
+                }
+                // A 45 degree sprint jump always takes its first tick.
+                if (movement.offset == 45.0f && isJump(movement) && movement.isSprinting) ticks = std::max(ticks, 1);
+                ticks = std::max(ticks, 0);
+                // Each movement moves with its own modifiers.
+                Player probe = player;
+                probe.setModifiers(movement.modifiers);
+                acceleration = probe.accelerationBound(movement.slipperiness, movement.isSprinting, isJump(movement));
+            }
+            bool teleports = stage.builtin.has_value() && stage.builtin != Builtin::Facing;
+            m_ticksLeft[i] = m_ticksLeft[i + 1] + ticks;
+            m_accelerationLeft[i] = std::max(m_accelerationLeft[i + 1], acceleration);
+            m_teleports[i] = m_teleports[i + 1] || teleports;
+            if (stage.parameter.has_value() && !laterParameter) {
+                laterParameter = true;
+                if (m_ticksLeft[i + 1] > 0) m_batched = i;
+            }
+        }
+    }
+
+    std::optional<size_t> run(const Player& player, bool parallel) {
+        // The stages before the first parameter are the same for every candidate.
+        Player start = player;
+        size_t stage = 0;
+        for (; !m_plan.stages[stage].parameter.has_value(); stage++) {
+            perform(m_plan.stages[stage], start, m_plan.stages[stage].duration);
+        }
+
+        BestCandidate best;
+        if (!parallel) {
+            visit(stage, start, 0, best);
+            return best.index;
+        }
+        // One subtree per value of the first parameter, from the state after its duration.
+        const SearchPlan::Stage& first = m_plan.stages[stage];
+        size_t stride = m_strides[first.parameter.value()];
+        std::vector<Player> states;
+        eachDuration(first, start, [&states](size_t, const Player& next) { states.push_back(next); });
+
+        ThreadPool& pool = ThreadPool::shared();
+        std::vector<BestCandidate> bests(pool.size());
+        if (stage == m_batched) {
+            // Nothing left to branch on, each task takes a batch of the states through the remaining stages.
+            size_t batches = (states.size() + BATCH_LANES - 1) / BATCH_LANES;
+            pool.parallelFor(batches, [&](size_t worker, size_t task) {
+                size_t begin = task * BATCH_LANES, end = std::min(states.size(), begin + BATCH_LANES);
+                PlayerBatch batch(states[begin], end - begin);
+                std::vector<size_t> indices;
+                for (size_t i = begin; i < end; i++) {
+                    if (!promising(stage + 1, states[i], i * stride)) continue;
+                    batch.load(indices.size(), states[i]);
+                    indices.push_back(i * stride);
+                }
+                finish(batch, indices, bests[worker]);
+            });
+        } else {
+            pool.parallelFor(states.size(), [&](size_t worker, size_t i) {
+                visit(stage + 1, states[i], i * stride, bests[worker]);
+            });
+        }
+        for (const BestCandidate& it : bests) {
+            if (it.index.has_value()) best.offer(it.index.value(), it.score);
+        }
+        return best.index;
+    }
+};
+}  // namespace
+
+std::optional<SearchPlan> planSearch(const OptimizeStmt& stmt, const std::function<bool(const CallExpr&)>& isFunction) {
+    SearchPlan plan;
+    plan.goal = stmt.goal;
+    if (stmt.goal == OptimizeStmt::Goal::Until) {
+        auto* comparison = dynamic_cast<const BinaryExpr*>(stmt.objective);
+        if (!comparison) return std::nullopt;
+        switch (comparison->op) {
+            case Operator::LessThan:
+            case Operator::GreaterThan:
+            case Operator::LessThanOrEquals:
+            case Operator::GreaterThanOrEquals:
+                break;
+            default:
+                return std::nullopt;
+        }
+        plan.op = comparison->op;
+        plan.fieldFirst = fieldOf(comparison->lhs).has_value();
+        std::optional<Field> field = fieldOf(plan.fieldFirst ? comparison->lhs : comparison->rhs);
+        std::optional<Value> target = literalValue(plan.fieldFirst ? comparison->rhs : comparison->lhs);
+        if (!field.has_value() || !target.has_value() || !numberOf(target.value()).has_value()) return std::nullopt;
+        plan.field = field.value();
+        plan.target = target.value();
+    } else {
+        std::optional<Field> field = fieldOf(stmt.objective);
+        if (!field.has_value()) return std::nullopt;
+        plan.field = field.value();
+    }
+
+    if (!addStages(stmt.body, stmt, isFunction, plan)) return std::nullopt;
+    // Every parameter is the duration of exactly one movement.
+    std::vector<int> uses(stmt.parameters.size());
+    for (const SearchPlan::Stage& stage : plan.stages) {
+        if (stage.parameter.has_value()) uses[stage.parameter.value()]++;
+    }
+    for (size_t i = 0; i < stmt.parameters.size(); i++) {
+        if (uses[i] != 1) return std::nullopt;
+        for (size_t j = 0; j < i; j++) {
+            if (stmt.parameters[i].identifier == stmt.parameters[j].identifier) return std::nullopt;
+        }
+    }
+    return plan;
+}
+
+std::optional<size_t> search(const SearchPlan& plan, const Player& player, const std::vector<SearchRange>& ranges,
+                             bool parallel) {
+    // Candidates aren't recorded, like the interpreters don't while they optimize.
+    Player start = player;
+    start.recorder = nullptr;
+    TreeSearch search(plan, ranges, start);
+    return search.run(start, parallel);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "builtins.h"
+#include "parser.h"
+#include "player.h"
+
+// An optimize statement whose body is a straight run of movements, each lasting a literal number of ticks or one of
+// the parameters, and whose objective is x, z, vx or vz, or one of them compared to a literal with until.
+//
+// Its candidates share every tick up to the first movement whose duration differs, so instead of running each one
+// from the start search() walks them as a tree, depth first, one tick per step, and skips the subtrees that can't
+// beat the best candidate found so far. Below the last parameter only fixed stages are left, so its children go
+// through them together, lanes of one PlayerBatch.
+struct SearchPlan {
+    struct Stage {
+        // A movement, or with `builtin` one of the builtins that only set the player, with `value` its argument.
+        std::optional<Builtin> builtin;
+        std::optional<float> value;
+        Movement movement;
+        std::optional<float> rotation;
+        int duration = 1;
+        // The duration is this parameter instead.
+        std::optional<size_t> parameter;
+    };
+    std::vector<Stage> stages;
+    OptimizeStmt::Goal goal = OptimizeStmt::Goal::Maximize;
+    Field field = Field::Z;
+    // With Goal::Until the objective is `field op target`, or `target op field` when `fieldFirst` is false.
+    Operator op = Operator::GreaterThan;
+    Value target;
+    bool fieldFirst = true;
+};
+
+// Nothing when the statement doesn't have that shape. `isFunction` tells the calls of script functions, whose names
+// may shadow movements, from the movements.
+std::optional<SearchPlan> planSearch(const OptimizeStmt& stmt, const std::function<bool(const CallExpr&)>& isFunction);
+// The candidate optimize would pick when it ran the body on `player` for every one, nothing if none counts. Splits
+// the tree between the pool workers unless `parallel` is false, the result is the same either way.
+std::optional<size_t> search(const SearchPlan& plan, const Player& player, const std::vector<SearchRange>& ranges,
+                             bool parallel);
@@ -0,0 +1,406 @@
+// Keeps scripts parsed and runs them for clients over a Unix domain socket, so tools evaluating many scripts don't
+// start sim and parse again for every one.
+//   ./server [--threads n] socket
+// A client sends requests, each a line of words. The ones with a length are followed by that many bytes of script.
+//   load NAME LENGTH [LIBRARY...]        parses the script after the source of the loaded LIBRARY scripts, and keeps it
+//   run NAME [FORMAT] [VAR=VALUE...]     runs a loaded script with the variables bound
+//   eval LENGTH [FORMAT] [VAR=VALUE...]  parses and runs a script once
+//   drop NAME
+// Each gets back "ok OUTPUT ERRORS\n", then OUTPUT bytes of what the output builtins wrote in FORMAT (text by default)
+// and ERRORS bytes of the statements that failed, or "error LENGTH\n" and a message when the request itself failed.
+// A value is an integer, a float, true or false, anything else is a string. Requests on one connection run in order,
+// those of different connections concurrently, every run on its own VM and Player. A worker thread is only taken
+// for one request at a time, once all of it has arrived, so any number of clients can stay connected.
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "vm.h"
+
+namespace {
+// Longest script a request may send.
+constexpr size_t MAX_LENGTH = 64 << 20;
+
+struct Loaded {
+    // With the libraries it was loaded after, so scripts loaded after this one can include it.
+    std::string source;
+    Script script;
+    // Compiled once, every run gets a VM of its own.
+    std::shared_ptr<const Program> program;
+};
+
+// The loaded scripts by name. Runs hold on to what they run, so a script can be dropped or loaded again meanwhile.
+class Scripts {
+   private:
+    std::unordered_map<std::string, std::shared_ptr<const Loaded>> m_scripts;
+    mutable std::shared_mutex m_mutex;
+
+   public:
+    std::shared_ptr<const Loaded> find(const std::string& name) const {
+        std::shared_lock lock(m_mutex);
+        auto it = m_scripts.find(name);
+        if (it == m_scripts.end()) throw std::runtime_error("No script loaded as " + name);
+        return it->second;
+    }
+    void store(const std::string& name, std::shared_ptr<const Loaded> loaded) {
+        std::unique_lock lock(m_mutex);
+        m_scripts.insert_or_assign(name, std::move(loaded));
+    }
+    void drop(const std::string& name) {
+        std::unique_lock lock(m_mutex);
+        if (m_scripts.erase(name) == 0) throw std::runtime_error("No script loaded as " + name);
+    }
+};
+
+std::shared_ptr<const Loaded> parse(std::string source) {
+    auto loaded = std::make_shared<Loaded>();
+    loaded->source = std::move(source);
+    Scanner scanner(loaded->source);
+    loaded->script = scanner.scan();
+    Optimizer(*loaded->script.arena).optimize(loaded->script);
+    loaded->program = std::make_shared<const Program>(Compiler().compile(loaded->script));
+    return loaded;
+}
+
+Value parseValue(std::string_view text) {
+    if (text == "true" || text == "false") return text == "true";
+    const char* end = text.data() + text.size();
+    int integer;
+    if (auto [ptr, ec] = std::from_chars(text.data(), end, integer); ec == std::errc() && ptr == end) return integer;
+    float floating;
+    if (auto [ptr, ec] = std::from_chars(text.data(), end, floating); ec == std::errc() && ptr == end) return floating;
+    // Script strings keep their quotes.
+    return "'" + std::string(text) + "'";
+}
+
+std::vector<std::string> split(const std::string& line) {
+    std::vector<std::string> words;
+    std::istringstream stream(line);
+    for (std::string word; stream >> word;) words.push_back(word);
+    return words;
+}
+
+size_t parseLength(const std::string& word) {
+    size_t length;
+    auto [ptr, ec] = std::from_chars(word.data(), word.data() + word.size(), length);
+    if (ec != std::errc() || ptr != word.data() + word.size()) throw std::runtime_error("Invalid length " + word);
+    if (length > MAX_LENGTH) throw std::runtime_error("Script too long");
+    return length;
+}
+
+// How many bytes of script follow a request line, 0 when its length is missing or invalid, which serve() reports.
+size_t scriptLength(const std::vector<std::string>& words) {
+    size_t at = words.empty() ? 0 : words[0] == "load" ? 2 : words[0] == "eval" ? 1 : 0;
+    if (at == 0 || at >= words.size()) return 0;
+    try {
+        return parseLength(words[at]);
+    } catch (std::exception&) {
+        return 0;
+    }
+}
+
+std::string reply(const std::string& output, const std::string& errors) {
+    return "ok " + std::to_string(output.size()) + " " + std::to_string(errors.size()) + "\n" + output + errors;
+}
+
+// Runs `loaded` with the format and bindings in words[first...], returns the reply.
+std::string run(const Loaded& loaded, const std::vector<std::string>& words, size_t first) {
+    Output::Format format = Output::Format::Text;
+    if (first < words.size()) {
+        if (std::optional<Output::Format> found = Output::findFormat(words[first])) {
+            format = found.value();
+            first++;
+        }
+    }
+    std::unique_ptr<Output> output = Output::create(format, -1);
+    std::ostringstream errors;
+    VM vm(loaded.program, *output, errors);
+    const std::vector<std::string_view>& names = loaded.script.names;
+    for (size_t i = first; i < words.size(); i++) {
+        size_t equals = words[i].find('=');
+        if (equals == std::string::npos) throw std::runtime_error("Expected VAR=VALUE, got " + words[i]);
+        std::string_view binding = words[i];
+        // A name the script never mentions can't be read by it either.
+        auto slot = std::find(names.begin(), names.end(), binding.substr(0, equals));
+        if (slot != names.end()) vm.define(slot - names.begin(), parseValue(binding.substr(equals + 1)));
+    }
+    vm.run();
+    return reply(output->take(), errors.str());
+}
+
+// A client's socket and what it has sent that hasn't been answered yet. The poll loop reads without waiting, so a
+// client that sends half a request holds up nobody. Workers only get to take complete requests out.
+class Connection {
+   private:
+    int m_fd;
+    std::string m_buffer;
+    size_t m_pos = 0;
+    // How far the buffer has been searched for the end of the next line, so a long one isn't searched again.
+    mutable size_t m_searched = 0;
+    bool m_closed = false;
+
+   public:
+    explicit Connection(int fd) : m_fd(fd) {}
+    ~Connection() { close(m_fd); }
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int fd() const { return m_fd; }
+    // Whether the client has stopped sending.
+    bool closed() const { return m_closed; }
+
+    // Reads what the client has sent so far, until a whole request is buffered.
+    void receive() {
+        m_buffer.erase(0, m_pos);
+        m_searched = m_searched > m_pos ? m_searched - m_pos : 0;
+        m_pos = 0;
+        char chunk[64 * 1024];
+        while (!pending()) {
+            ssize_t count = recv(m_fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if (count <= 0) {
+                m_closed = true;
+                return;
+            }
+            m_buffer.append(chunk, count);
+        }
+    }
+
+    // Whether the next request has arrived with all of its script, or its line is too long to ever be one.
+    bool pending() const {
+        size_t end = m_buffer.find('\n', std::max(m_pos, m_searched));
+        if (end == std::string::npos) {
+            m_searched = m_buffer.size();
+            return m_buffer.size() - m_pos > MAX_LENGTH;
+        }
+        m_searched = end;
+        return m_buffer.size() - end - 1 >= scriptLength(split(m_buffer.substr(m_pos, end - m_pos)));
+    }
+
+    std::optional<std::string> line() {
+        size_t end = m_buffer.find('\n', m_pos);
+        if (end == std::string::npos) return std::nullopt;
+        std::string line = m_buffer.substr(m_pos, end - m_pos);
+        m_pos = end + 1;
+        return line;
+    }
+
+    std::string read(size_t length) {
+        if (m_buffer.size() - m_pos < length) {
+            // What did arrive of the script isn't taken for requests.
+            m_pos = m_buffer.size();
+            throw std::runtime_error("Connection closed before the script ended");
+        }
+        std::string bytes = m_buffer.substr(m_pos, length);
+        m_pos += length;
+        return bytes;
+    }
+
+    bool write(std::string_view bytes) {
+        while (!bytes.empty()) {
+            ssize_t count = send(m_fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) return false;
+            bytes.remove_prefix(count);
+        }
+        return true;
+    }
+};
+
+// Answers the request the connection has buffered. False when there is none, it closed halfway through a line.
+bool serve(Scripts& scripts, Connection& connection) {
+    std::optional<std::string> line = connection.line();
+    if (!line.has_value()) return false;
+    std::string answer;
+    try {
+        std::vector<std::string> words = split(line.value());
+        if (words.empty()) return true;
+        const std::string& command = words[0];
+        if (command == "load" && words.size() >= 3) {
+            std::string source = connection.read(parseLength(words[2]));
+            std::string libraries;
+            for (size_t i = 3; i < words.size(); i++) libraries += scripts.find(words[i])->source + "\n";
+            scripts.store(words[1], parse(libraries + source));
+            answer = reply("", "");
+        } else if (command == "run" && words.size() >= 2) {
+            answer = run(*scripts.find(words[1]), words, 2);
+        } else if (command == "eval" && words.size() >= 2) {
+            answer = run(*parse(connection.read(parseLength(words[1]))), words, 2);
+        } else if (command == "drop" && words.size() == 2) {
+            scripts.drop(words[1]);
+            answer = reply("", "");
+        } else {
+            throw std::runtime_error("Unknown request " + line.value());
+        }
+    } catch (std::exception& e) {
+        std::string message = e.what();
+        answer = "error " + std::to_string(message.size()) + "\n" + message;
+    }
+    return connection.write(answer);
+}
+
+// Polls the idle connections, reads what they send and hands each one whose next request has arrived in full to a
+// fixed set of worker threads. A worker answers that one request and gives the connection back, so a connection is
+// in one place at a time.
+class Workers {
+   private:
+    Scripts& m_scripts;
+    // Connections with a complete request waiting.
+    std::deque<std::unique_ptr<Connection>> m_ready;
+    // Connections the workers gave back, for the poll loop to watch again.
+    std::vector<std::unique_ptr<Connection>> m_returned;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // Wakes the poll loop when a connection is given back.
+    int m_pipe[2];
+
+   private:
+    void workerLoop() {
+        for (;;) {
+            std::unique_ptr<Connection> connection;
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [this] { return !m_ready.empty(); });
+                connection = std::move(m_ready.front());
+                m_ready.pop_front();
+            }
+            if (!serve(m_scripts, *connection)) continue;
+            if (connection->pending()) {
+                // Already sent its next request, it waits behind the others.
+                ready(std::move(connection));
+                continue;
+            }
+            if (connection->closed()) continue;
+            {
+                std::lock_guard lock(m_mutex);
+                m_returned.push_back(std::move(connection));
+            }
+            // The pipe doesn't block, a full one wakes the poll loop just as well.
+            char byte = 0;
+            while (::write(m_pipe[1], &byte, 1) < 0 && errno == EINTR) {
+            }
+        }
+    }
+
+    void ready(std::unique_ptr<Connection> connection) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_ready.push_back(std::move(connection));
+        }
+        m_wake.notify_one();
+    }
+
+   public:
+    Workers(Scripts& scripts, size_t threads) : m_scripts(scripts) {
+        if (pipe(m_pipe) != 0) throw std::runtime_error(std::string("Can't create pipe: ") + std::strerror(errno));
+        for (int fd : m_pipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        // They serve until the process exits.
+        for (size_t i = 0; i < threads; i++) std::thread([this] { workerLoop(); }).detach();
+    }
+
+    // Accepts clients on `listener` and waits for their requests. Only returns when that fails.
+    void run(int listener) {
+        std::vector<std::unique_ptr<Connection>> idle;
+        std::vector<pollfd> fds;
+        for (;;) {
+            {
+                std::lock_guard lock(m_mutex);
+                for (auto& connection : m_returned) idle.push_back(std::move(connection));
+                m_returned.clear();
+            }
+            fds.assign({pollfd{listener, POLLIN, 0}, pollfd{m_pipe[0], POLLIN, 0}});
+            for (auto& connection : idle) fds.push_back(pollfd{connection->fd(), POLLIN, 0});
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                std::perror("poll");
+                return;
+            }
+            if (fds[1].revents != 0) {
+                char bytes[64];
+                while (::read(m_pipe[0], bytes, sizeof(bytes)) > 0 || errno == EINTR) {
+                }
+            }
+            // A closed connection goes to a worker too, which answers what is left of its requests and drops it.
+            size_t kept = 0;
+            for (size_t i = 0; i < idle.size(); i++) {
+                if (fds[i + 2].revents != 0) idle[i]->receive();
+                if (idle[i]->pending() || idle[i]->closed()) {
+                    ready(std::move(idle[i]));
+                } else {
+                    idle[kept++] = std::move(idle[i]);
+                }
+            }
+            idle.resize(kept);
+            if (fds[0].revents != 0) {
+                int client = accept(listener, nullptr, nullptr);
+                if (client >= 0) {
+                    idle.push_back(std::make_unique<Connection>(client));
+                } else if (errno != EINTR && errno != ECONNABORTED) {
+                    std::perror("accept");
+                    return;
+                }
+            }
+        }
+    }
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    int arg = 1;
+    if (argc > arg + 1 && std::string_view(argv[arg]) == "--threads") {
+        threads = std::max(std::atoi(argv[arg + 1]), 1);
+        arg += 2;
+    }
+    if (argc != arg + 1) {
+        std::fprintf(stderr, "usage: %s [--threads n] socket\n", argv[0]);
+        return 1;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(argv[arg]) >= sizeof(address.sun_path)) {
+        std::fprintf(stderr, "%s: socket path too long\n", argv[arg]);
+        return 1;
+    }
+    std::strcpy(address.sun_path, argv[arg]);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(address.sun_path);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        std::perror(argv[arg]);
+        return 1;
+    }
+
+    Scripts scripts;
+    Workers workers(scripts, threads);
+    workers.run(listener);
+    return 1;
+}
@@ -0,0 +1,291 @@
+#include <optional>
+
+#include "playerbatch.h"
+
+// Vector versions of PlayerBatch::advance. They only ever perform the operations the scalar code does, in the same
+// order and precision, and never FMA, so every lane rounds exactly like Player::update. Ladders are left to the scalar
+// code.
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static __m128 gatherSin(const float* table, __m128 radians) {
+    __m128i index = _mm_cvttps_epi32(_mm_mul_ps(radians, _mm_set1_ps(10430.378f)));
+    return _mm_i32gather_ps(table, _mm_and_si128(index, _mm_set1_epi32(0xffff)), 4);
+}
+
+__attribute__((target("avx2"))) static __m128 gatherCos(const float* table, __m128 radians) {
+    __m128 scaled = _mm_add_ps(_mm_mul_ps(radians, _mm_set1_ps(10430.378f)), _mm_set1_ps(16384.0f));
+    return _mm_i32gather_ps(table, _mm_and_si128(_mm_cvttps_epi32(scaled), _mm_set1_epi32(0xffff)), 4);
+}
+
+__attribute__((target("avx2"))) static __m256d applyInertia(__m256d velocity, __m256d threshold) {
+    __m256d magnitude = _mm256_andnot_pd(_mm256_set1_pd(-0.0), velocity);
+    return _mm256_andnot_pd(_mm256_cmp_pd(magnitude, threshold, _CMP_LT_OQ), velocity);
+}
+
+__attribute__((target("avx2"))) void PlayerBatch::advanceAvx2(size_t lane, int duration, const Tick& tick) {
+    const float* table = Player::SIN_TABLE.data();
+    float previousSlipperiness = m_previousSlipperiness[lane];
+    float slipperiness = tick.slipperiness;
+    uint8_t flags = m_flags[lane];
+    State state = tick.state;
+    if (sneaking(flags, tick) && tick.lava) state = State::AIRBORNE;
+
+    __m128 rotation = tick.overrideRotation
+                          ? _mm_set1_ps(tick.rotation)
+                          : _mm_add_ps(_mm_loadu_ps(&m_rotation[lane]), _mm_set1_ps(tick.rotationOffset));
+    __m128 facing = _mm_mul_ps(rotation, _mm_set1_ps(0.017453292f));
+    __m128 boost = _mm_set1_ps(tick.sprintjumpBoost);
+    __m256d jumpX = _mm256_cvtps_pd(_mm_mul_ps(gatherSin(table, facing), boost));
+    __m256d jumpZ = _mm256_cvtps_pd(_mm_mul_ps(gatherCos(table, facing), boost));
+    __m128 yaw = _mm256_cvtpd_ps(
+        _mm256_div_pd(_mm256_mul_pd(_mm256_cvtps_pd(rotation), _mm256_set1_pd(PI)), _mm256_set1_pd(180.0f)));
+    __m128 sinYaw = gatherSin(table, yaw);
+    __m128 cosYaw = gatherCos(table, yaw);
+
+    __m256d x = _mm256_loadu_pd(&positionX[lane]), z = _mm256_loadu_pd(&positionZ[lane]);
+    __m256d vx = _mm256_loadu_pd(&velocityX[lane]), vz = _mm256_loadu_pd(&velocityZ[lane]);
+    __m256d threshold = _mm256_set1_pd(tick.rules.inertiaThreshold);
+
+    int i = 0;
+    for (; i < duration; i++) {
+        // The same split into settling and identical ticks as the scalar code.
+        if (i > 0 && tick.repeats && state != State::JUMPING && previousSlipperiness == slipperiness) break;
+
+        x = _mm256_add_pd(x, vx);
+        z = _mm256_add_pd(z, vz);
+
+        if (tick.soulsand) {
+            vx = _mm256_mul_pd(vx, _mm256_set1_pd(0.4));
+            vz = _mm256_mul_pd(vz, _mm256_set1_pd(0.4));
+        }
+
+        __m256d friction = _mm256_set1_pd(0.91 * previousSlipperiness);
+        vx = _mm256_mul_pd(vx, friction);
+        vz = _mm256_mul_pd(vz, friction);
+
+        if (flags & PREVIOUSLY_IN_WEB) {
+            vx = _mm256_setzero_pd();
+            vz = _mm256_setzero_pd();
+        } else {
+            vx = applyInertia(vx, threshold);
+            vz = applyInertia(vz, threshold);
+        }
+
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        previousSlipperiness = slipperiness;
+
+        if (state == State::JUMPING) {
+            state = State::AIRBORNE;
+            slipperiness = 1.0f;
+            if (tick.isSprinting) {
+                vx = _mm256_sub_pd(vx, jumpX);
+                vz = _mm256_add_pd(vz, jumpZ);
+            }
+        }
+
+        if (acceleration.has_value()) {
+            __m128 forward = _mm_set1_ps(acceleration->x), strafe = _mm_set1_ps(acceleration->z);
+            __m128 ax = _mm_sub_ps(_mm_mul_ps(strafe, cosYaw), _mm_mul_ps(forward, sinYaw));
+            __m128 az = _mm_add_ps(_mm_mul_ps(forward, cosYaw), _mm_mul_ps(strafe, sinYaw));
+            vx = _mm256_add_pd(vx, _mm256_cvtps_pd(ax));
+            vz = _mm256_add_pd(vz, _mm256_cvtps_pd(az));
+        }
+
+        if (tick.web) {
+            vx = _mm256_mul_pd(vx, _mm256_set1_pd(0.25f));
+            vz = _mm256_mul_pd(vz, _mm256_set1_pd(0.25f));
+        }
+
+        flags = nextFlags(tick);
+    }
+
+    if (i < duration) {
+        __m256d friction = _mm256_set1_pd(0.91 * previousSlipperiness);
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        if (acceleration.has_value()) {
+            __m128 forward = _mm_set1_ps(acceleration->x), strafe = _mm_set1_ps(acceleration->z);
+            __m256d ax = _mm256_cvtps_pd(_mm_sub_ps(_mm_mul_ps(strafe, cosYaw), _mm_mul_ps(forward, sinYaw)));
+            __m256d az = _mm256_cvtps_pd(_mm_add_ps(_mm_mul_ps(forward, cosYaw), _mm_mul_ps(strafe, sinYaw)));
+            for (; i < duration; i++) {
+                x = _mm256_add_pd(x, vx);
+                z = _mm256_add_pd(z, vz);
+                vx = _mm256_add_pd(applyInertia(_mm256_mul_pd(vx, friction), threshold), ax);
+                vz = _mm256_add_pd(applyInertia(_mm256_mul_pd(vz, friction), threshold), az);
+            }
+        } else {
+            for (; i < duration; i++) {
+                x = _mm256_add_pd(x, vx);
+                z = _mm256_add_pd(z, vz);
+                vx = applyInertia(_mm256_mul_pd(vx, friction), threshold);
+                vz = applyInertia(_mm256_mul_pd(vz, friction), threshold);
+            }
+        }
+    }
+
+    _mm256_storeu_pd(&positionX[lane], x);
+    _mm256_storeu_pd(&positionZ[lane], z);
+    _mm256_storeu_pd(&velocityX[lane], vx);
+    _mm256_storeu_pd(&velocityZ[lane], vz);
+    for (size_t i = lane; i < lane + 4; i++) {
+        m_previousSlipperiness[i] = previousSlipperiness;
+        m_state[i] = state;
+        m_flags[i] = flags;
+    }
+}
+
+__attribute__((target("sse2"))) static __m128d applyInertia(__m128d velocity, __m128d threshold) {
+    __m128d magnitude = _mm_andnot_pd(_mm_set1_pd(-0.0), velocity);
+    return _mm_andnot_pd(_mm_cmplt_pd(magnitude, threshold), velocity);
+}
+
+// SSE2 has no gathers, the table lookups happen once per move in scalar code instead.
+__attribute__((target("sse2"))) void PlayerBatch::advanceSse2(size_t lane, int duration, const Tick& tick) {
+    Player& p = m_prototype;
+    float previousSlipperiness = m_previousSlipperiness[lane];
+    float slipperiness = tick.slipperiness;
+    uint8_t flags = m_flags[lane];
+    State state = tick.state;
+    if (sneaking(flags, tick) && tick.lava) state = State::AIRBORNE;
+
+    float jumpX[2], jumpZ[2], sinYaw[2], cosYaw[2];
+    for (size_t i = 0; i < 2; i++) {
+        float rotation = tick.overrideRotation ? tick.rotation : m_rotation[lane + i] + tick.rotationOffset;
+        float facing = rotation * 0.017453292f;
+        jumpX[i] = p.mcsin(facing) * tick.sprintjumpBoost;
+        jumpZ[i] = p.mccos(facing) * tick.sprintjumpBoost;
+        sinYaw[i] = p.mcsin(rotation * PI / 180.0f);
+        cosYaw[i] = p.mccos(rotation * PI / 180.0f);
+    }
+    __m128d jumpXs = _mm_set_pd(jumpX[1], jumpX[0]), jumpZs = _mm_set_pd(jumpZ[1], jumpZ[0]);
+    __m128 sinYaws = _mm_set_ps(0.0f, 0.0f, sinYaw[1], sinYaw[0]);
+    __m128 cosYaws = _mm_set_ps(0.0f, 0.0f, cosYaw[1], cosYaw[0]);
+
+    __m128d x = _mm_loadu_pd(&positionX[lane]), z = _mm_loadu_pd(&positionZ[lane]);
+    __m128d vx = _mm_loadu_pd(&velocityX[lane]), vz = _mm_loadu_pd(&velocityZ[lane]);
+    __m128d threshold = _mm_set1_pd(tick.rules.inertiaThreshold);
+
+    int i = 0;
+    for (; i < duration; i++) {
+        // The same split into settling and identical ticks as the scalar code.
+        if (i > 0 && tick.repeats && state != State::JUMPING && previousSlipperiness == slipperiness) break;
+
+        x = _mm_add_pd(x, vx);
+        z = _mm_add_pd(z, vz);
+
+        if (tick.soulsand) {
+            vx = _mm_mul_pd(vx, _mm_set1_pd(0.4));
+            vz = _mm_mul_pd(vz, _mm_set1_pd(0.4));
+        }
+
+        __m128d friction = _mm_set1_pd(0.91 * previousSlipperiness);
+        vx = _mm_mul_pd(vx, friction);
+        vz = _mm_mul_pd(vz, friction);
+
+        if (flags & PREVIOUSLY_IN_WEB) {
+            vx = _mm_setzero_pd();
+            vz = _mm_setzero_pd();
+        } else {
+            vx = applyInertia(vx, threshold);
+            vz = applyInertia(vz, threshold);
+        }
+
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        previousSlipperiness = slipperiness;
+
+        if (state == State::JUMPING) {
+            state = State::AIRBORNE;
+            slipperiness = 1.0f;
+            if (tick.isSprinting) {
+                vx = _mm_sub_pd(vx, jumpXs);
+                vz = _mm_add_pd(vz, jumpZs);
+            }
+        }
+
+        if (acceleration.has_value()) {
+            __m128 forward = _mm_set1_ps(acceleration->x), strafe = _mm_set1_ps(acceleration->z);
+            __m128 ax = _mm_sub_ps(_mm_mul_ps(strafe, cosYaws), _mm_mul_ps(forward, sinYaws));
+            __m128 az = _mm_add_ps(_mm_mul_ps(forward, cosYaws), _mm_mul_ps(strafe, sinYaws));
+            vx = _mm_add_pd(vx, _mm_cvtps_pd(ax));
+            vz = _mm_add_pd(vz, _mm_cvtps_pd(az));
+        }
+
+        if (tick.web) {
+            vx = _mm_mul_pd(vx, _mm_set1_pd(0.25f));
+            vz = _mm_mul_pd(vz, _mm_set1_pd(0.25f));
+        }
+
+        flags = nextFlags(tick);
+    }
+
+    if (i < duration) {
+        __m128d friction = _mm_set1_pd(0.91 * previousSlipperiness);
+        std::optional<Vector2<float>> acceleration = this->acceleration(state, flags, tick);
+        if (acceleration.has_value()) {
+            __m128 forward = _mm_set1_ps(acceleration->x), strafe = _mm_set1_ps(acceleration->z);
+            __m128d ax = _mm_cvtps_pd(_mm_sub_ps(_mm_mul_ps(strafe, cosYaws), _mm_mul_ps(forward, sinYaws)));
+            __m128d az = _mm_cvtps_pd(_mm_add_ps(_mm_mul_ps(forward, cosYaws), _mm_mul_ps(strafe, sinYaws)));
+            for (; i < duration; i++) {
+                x = _mm_add_pd(x, vx);
+                z = _mm_add_pd(z, vz);
+                vx = _mm_add_pd(applyInertia(_mm_mul_pd(vx, friction), threshold), ax);
+                vz = _mm_add_pd(applyInertia(_mm_mul_pd(vz, friction), threshold), az);
+            }
+        } else {
+            for (; i < duration; i++) {
+                x = _mm_add_pd(x, vx);
+                z = _mm_add_pd(z, vz);
+                vx = applyInertia(_mm_mul_pd(vx, friction), threshold);
+                vz = applyInertia(_mm_mul_pd(vz, friction), threshold);
+            }
+        }
+    }
+
+    _mm_storeu_pd(&positionX[lane], x);
+    _mm_storeu_pd(&positionZ[lane], z);
+    _mm_storeu_pd(&velocityX[lane], vx);
+    _mm_storeu_pd(&velocityZ[lane], vz);
+    for (size_t i = lane; i < lane + 2; i++) {
+        m_previousSlipperiness[i] = previousSlipperiness;
+        m_state[i] = state;
+        m_flags[i] = flags;
+    }
+}
+
+PlayerBatch::KernelInfo& PlayerBatch::kernel() {
+    static KernelInfo info = []() -> KernelInfo {
+        if (__builtin_cpu_supports("avx2")) return {&PlayerBatch::advanceAvx2, 4, "avx2"};
+        if (__builtin_cpu_supports("sse2")) return {&PlayerBatch::advanceSse2, 2, "sse2"};
+        return {&PlayerBatch::advance, 1, "scalar"};
+    }();
+    return info;
+}
+
+bool PlayerBatch::useKernel(std::string_view name) {
+    if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+        kernel() = {&PlayerBatch::advanceAvx2, 4, "avx2"};
+    } else if (name == "sse2" && __builtin_cpu_supports("sse2")) {
+        kernel() = {&PlayerBatch::advanceSse2, 2, "sse2"};
+    } else if (name == "scalar") {
+        kernel() = {&PlayerBatch::advance, 1, "scalar"};
+    } else {
+        return false;
+    }
+    return true;
+}
+#else
+void PlayerBatch::advanceAvx2(size_t lane, int duration, const Tick& tick) {
+    for (size_t i = lane; i < lane + 4; i++) advance(i, duration, tick);
+}
+
+void PlayerBatch::advanceSse2(size_t lane, int duration, const Tick& tick) {
+    for (size_t i = lane; i < lane + 2; i++) advance(i, duration, tick);
+}
+
+PlayerBatch::KernelInfo& PlayerBatch::kernel() {
+    static KernelInfo info{&PlayerBatch::advance, 1, "scalar"};
+    return info;
+}
+
+bool PlayerBatch::useKernel(std::string_view name) { return name == "scalar"; }
+#endif
@@ -0,0 +1,40 @@
+// Writes the definition of Player::SIN_TABLE, run by the build to produce sintable.cpp.
+//
+// The values are computed exactly like Minecraft fills its table at startup and printed as hex floats, which parse
+// back to the same bits. Every one is read back and compared before the file is kept.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "player.h"
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s OUTPUT\n", argv[0]);
+        return 1;
+    }
+    std::FILE* out = std::fopen(argv[1], "w");
+    if (!out) {
+        std::perror(argv[1]);
+        return 1;
+    }
+
+    std::fprintf(out, "// Generated by sintable_gen.cpp, do not edit.\n#include \"player.h\"\n\n");
+    std::fprintf(out, "constinit const std::array<float, 65536> Player::SIN_TABLE = {");
+    for (size_t i = 0; i < 65536; i++) {
+        float value = static_cast<float>(std::sin(PI * 2.0 * i / 65536.0));
+        char text[32];
+        std::snprintf(text, sizeof(text), "%a", value);
+        float parsed = std::strtof(text, nullptr);
+        if (std::memcmp(&parsed, &value, sizeof(float)) != 0) {
+            std::fprintf(stderr, "%s does not round trip for index %zu\n", text, i);
+            std::fclose(out);
+            std::remove(argv[1]);
+            return 1;
+        }
+        std::fprintf(out, "%s%sf,", i % 4 == 0 ? "\n    " : " ", text);
+    }
+    std::fprintf(out, "\n};\n");
+    return std::fclose(out) == 0 ? 0 : 1;
+}
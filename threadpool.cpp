@@ -0,0 +1,123 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    m_slices = std::make_unique<Slice[]>(threads);
+    for (size_t i = 0; i < threads; i++) m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) thread.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t worker, size_t index)>& body) {
+    if (count == 0) return;
+    Job job;
+    job.body = &body;
+    // Small enough chunks to balance, large enough that the slice locks stay cold.
+    job.grain = std::clamp<size_t>(count / (size() * 16), 1, 64);
+
+    std::lock_guard jobLock(m_jobMutex);
+    std::unique_lock lock(m_mutex);
+    size_t per = count / size(), extra = count % size(), begin = 0;
+    for (size_t i = 0; i < size(); i++) {
+        size_t length = per + (i < extra ? 1 : 0);
+        std::lock_guard sliceLock(m_slices[i].mutex);
+        m_slices[i].begin = begin;
+        m_slices[i].end = begin + length;
+        begin += length;
+    }
+    m_job = &job;
+    m_running = size();
+    m_generation++;
+    m_wake.notify_all();
+    m_done.wait(lock, [this] { return m_running == 0; });
+    m_job = nullptr;
+    lock.unlock();
+
+    if (job.error) std::rethrow_exception(job.error);
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+    size_t generation = 0;
+    for (;;) {
+        Job* job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_wake.wait(lock, [this, generation] { return m_stopping || m_generation != generation; });
+            if (m_stopping) return;
+            generation = m_generation;
+            job = m_job;
+        }
+        runJob(worker, *job);
+        {
+            std::lock_guard lock(m_mutex);
+            if (--m_running == 0) m_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runJob(size_t worker, Job& job) {
+    size_t begin, end;
+    do {
+        while (take(worker, job.grain, begin, end)) {
+            for (size_t i = begin; i < end; i++) {
+                try {
+                    (*job.body)(worker, i);
+                } catch (...) {
+                    std::lock_guard lock(job.errorMutex);
+                    if (!job.error) job.error = std::current_exception();
+                }
+            }
+        }
+    } while (steal(worker));
+}
+
+bool ThreadPool::take(size_t worker, size_t grain, size_t& begin, size_t& end) {
+    Slice& slice = m_slices[worker];
+    std::lock_guard lock(slice.mutex);
+    if (slice.begin == slice.end) return false;
+    begin = slice.begin;
+    end = std::min(slice.end, begin + grain);
+    slice.begin = end;
+    return true;
+}
+
+bool ThreadPool::steal(size_t worker) {
+    size_t victim = worker, largest = 0;
+    for (size_t i = 0; i < size(); i++) {
+        if (i == worker) continue;
+        std::lock_guard lock(m_slices[i].mutex);
+        if (m_slices[i].end - m_slices[i].begin > largest) {
+            largest = m_slices[i].end - m_slices[i].begin;
+            victim = i;
+        }
+    }
+    if (victim == worker) return false;
+
+    size_t begin, end;
+    {
+        std::lock_guard lock(m_slices[victim].mutex);
+        Slice& slice = m_slices[victim];
+        if (slice.begin == slice.end) return true;  // drained meanwhile, look again
+        begin = slice.begin + (slice.end - slice.begin) / 2;
+        end = slice.end;
+        slice.end = begin;
+    }
+    std::lock_guard lock(m_slices[worker].mutex);
+    m_slices[worker].begin = begin;
+    m_slices[worker].end = end;
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops.
+//
+// Every worker starts out owning an equal slice of the index range and takes small chunks from the front of it. A
+// worker that runs dry steals the back half of the largest slice left, so uneven candidates still balance out.
+class ThreadPool {
+   private:
+    struct alignas(64) Slice {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    struct Job {
+        const std::function<void(size_t worker, size_t index)>* body = nullptr;
+        size_t grain = 1;
+        std::exception_ptr error;
+        std::mutex errorMutex;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::unique_ptr<Slice[]> m_slices;
+    std::mutex m_jobMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    Job* m_job = nullptr;
+    size_t m_generation = 0;
+    size_t m_running = 0;
+    bool m_stopping = false;
+
+   private:
+    void workerLoop(size_t worker);
+    void runJob(size_t worker, Job& job);
+    bool take(size_t worker, size_t grain, size_t& begin, size_t& end);
+    bool steal(size_t worker);
+
+   public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return m_threads.size(); }
+    // Calls body(worker, index) for every index below count and returns once all calls are done. The first
+    // exception thrown by a call is rethrown here. Must not be called from inside a body.
+    void parallelFor(size_t count, const std::function<void(size_t worker, size_t index)>& body);
+
+    static ThreadPool& shared();
+};
@@ -0,0 +1,396 @@
+// Golden traces of player physics. Runs movement scripts through every engine that advances a player and checks that
+// each one reproduces the reference, every tick through Player::update, bit for bit at every tick. Then times them.
+//   ./trace                              the built in corpus against the reference
+//   ./trace record script.mb golden      writes the reference trace of a script
+//   ./trace check script.mb [golden]     every engine against a recorded trace, or the reference when there is none
+//   ./trace compare script.mb            the tree-walker against the VM, with and without optimize searches
+// Record a golden before touching the physics and check against it after. Only scripts of top level calls with
+// literal arguments are traced, and each tick is simulated again from the start of its call, so keep them short.
+// Comparing runs any script on both interpreters, they must print the same, report the same errors and leave the
+// same player behind. The built in scripts are compared too.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "builtins.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "player.h"
+#include "playerbatch.h"
+#include "vm.h"
+
+namespace {
+// Odd, so the vector kernels leave lanes to the scalar one.
+constexpr size_t BATCH_SIZE = 7;
+constexpr char MAGIC[8] = {'M', 'B', 'T', 'R', 'A', 'C', 'E', 2};
+
+const char* const CORPUS[] = {
+    "sprintjump 12 sprintair 11 sprint 5 sprintjump45 12 sprintair45 11",
+    "facing 30.3 stopjump walkair.s 0 sneak.s 4 stop stopjump sprintair sprintair 10 | sprintjump 12 "
+    "| sprint 5 sprintjump 1 sprintair45 11 | facing -44 sprint 7 17.3 sprintjump 12 190.0",
+    "facing 12.5 setvx 0.3 setvz -0.2 walkair 5 sneak 20 walk45 10 sprint45 10 sneaksprint.sd 6 walkjump45 3",
+    "setx 0.6 setz -1.3 walk.wd 9 270.0 stop 4 sprint.a 8 45.0 sprintjump.wa 1 walkair.sd 12 sneak45 7",
+    "facing -170.3 sprint 400 walk 300 sprintair 200 stopjump 1 stopair 60",
+    "sprint[water] 6 sprintjump[web] 3 sprintair 4 sprint[soulsand][block] 5 walk[lava] 4 sneak[soulsand] 3 walk 3",
+    "version '1.12' sprintjump 12 sprintair 11 sneak 4 stop 30 walk45 6 sneaksprint 3 sprintair 5",
+    "version '1.14' sneak 3 sprintjump 2 sneakair 4 sneak 5 walk 2 sneak[lava] 3 stop 30 sprint 4 sneakjump 1",
+};
+
+// Scripts the interpreters have disagreed on.
+const char* const SCRIPTS[] = {
+    "if false { fn pick() { print 'first' } } fn pick() { print 'second' } pick",
+    "if false { fn hop(n) { print 'never' } } let i = 0 while i < 3 { hop 2 if i == 1 { fn hop(n) { sprint n } } "
+    "if i == 2 { fn hop(n) { print 'third' } } i = i + 1 } hop 3 outz",
+    "let total = 0 fn step(k) { total = total + k } let i = 0 while i < 10 { step i i = i + 1 } print total",
+    "fn run(t) { sprint t } optimize t 1 20 1 { run t sprintjump 12 } maximize z outz",
+    "print undefined let text = 'a' undefined = 2 text = text + 1 fn show() { print text other = 1 } show",
+    "optimize tt 1 20 1 { sprintjump[water] tt } until z > 1.0 outz",
+    "optimize tt 1 20 1 { sprintjump[lava] tt } maximize x outx",
+    "optimize tt 1 20 1 { sprintjump45[water] tt sprintair[web] 3 } maximize z outz",
+    "optimize tt 1 20 1 { sprint[soulsand] 3 sprintjump[block] tt sprintair 2 } maximize z outz",
+    "facing -90 setx 5 optimize tt 1 20 1 { setx sprint tt } until x > 2.0 outx",
+    "facing 30 optimize tt 1 20 1 { facing sprint tt } until x < -1.0 outx",
+    "let qq = 1 fn hh() { let qq = nothere qq = 7 print qq } hh print qq",
+    "let nn = 3 fn rr() { nn = nn - 1 if nn > 0 { fn rr() { print 'inner' rr } rr } } rr print nn",
+    "let nn = 3 fn rr() { let mm = nn nn = nn - 1 if nn > 0 { fn rr() { print 'x' } rr } print mm } rr print nn",
+};
+
+// One top level call of a script.
+struct Step {
+    std::optional<Builtin> builtin;
+    std::vector<Value> args;
+    Movement movement;
+    int duration = 1;
+    std::optional<float> rotation;
+};
+
+// The state of the player after one tick, laid out the way traces store it.
+struct Sample {
+    double x, z, vx, vz;
+    float rotation;
+    float lastRotation;
+    float lastTurn;
+    uint8_t state;
+    uint8_t keys;
+    // The call the tick belongs to.
+    uint16_t step;
+};
+static_assert(sizeof(Sample) == 48, "Sample is written as is");
+
+struct Engine {
+    std::string name;
+    // Players advanced at once, the time of a tick is shared between them.
+    size_t lanes;
+    // Performs `duration` ticks of the movement of `step`.
+    std::function<void(Player& player, const Step& step, int duration)> move;
+};
+
+void collect(Stmt* stmt, std::vector<Step>& steps) {
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        if (block->tap) throw std::runtime_error("Taps can't be traced");
+        for (Stmt* inner : block->statements) collect(inner, steps);
+        return;
+    }
+    auto* exprStmt = dynamic_cast<ExprStmt*>(stmt);
+    auto* call = exprStmt ? dynamic_cast<CallExpr*>(exprStmt->expression) : nullptr;
+    if (!call) throw std::runtime_error("Only calls can be traced");
+
+    Step step;
+    step.builtin = call->builtin;
+    step.movement = call->movement;
+    for (Expr* arg : call->arguments) {
+        auto* literal = dynamic_cast<LiteralExpr*>(arg);
+        if (!literal) throw std::runtime_error("Only literal arguments can be traced");
+        step.args.push_back(literal->evaluate());
+    }
+    // Like CodeVisitor::visitCallExpr, the first two arguments of a movement are its duration and rotation.
+    if (!step.builtin.has_value() && step.args.size() > 0) {
+        if (const int* duration = std::get_if<int>(&step.args[0])) {
+            step.duration = *duration;
+        } else if (const float* duration = std::get_if<float>(&step.args[0])) {
+            step.duration = static_cast<int>(*duration);
+        } else {
+            throw std::runtime_error("Expected int");
+        }
+    }
+    if (!step.builtin.has_value() && step.args.size() > 1) {
+        if (const int* rotation = std::get_if<int>(&step.args[1])) {
+            step.rotation = static_cast<float>(*rotation);
+        } else if (const float* rotation = std::get_if<float>(&step.args[1])) {
+            step.rotation = *rotation;
+        } else {
+            throw std::runtime_error("Expected float");
+        }
+    }
+    steps.push_back(std::move(step));
+}
+
+std::vector<Step> load(Scanner& scanner) {
+    Script script = scanner.scan();
+    Optimizer(*script.arena).optimize(script);
+    std::vector<Step> steps;
+    collect(script.root, steps);
+    return steps;
+}
+
+Output& discard() {
+    static std::unique_ptr<Output> output = [] {
+        std::unique_ptr<Output> output = Output::create(Output::Format::Text, -1);
+        output->mute(true);
+        return output;
+    }();
+    return *output;
+}
+
+Sample sample(const Player& player, size_t step) {
+    return {player.position.x, player.position.z, player.velocity.x, player.velocity.z, player.rotation(),
+            player.lastRotation(), player.lastTurn(), static_cast<uint8_t>(player.state()), player.keys,
+            static_cast<uint16_t>(step)};
+}
+
+// The reference, Player::move as the interpreters use it, and a batch for every kernel this CPU runs.
+std::vector<Engine> engines() {
+    std::vector<Engine> engines;
+    for (bool stepExecution : {true, false}) {
+        engines.push_back({stepExecution ? "reference" : "player", 1,
+                           [stepExecution](Player& player, const Step& step, int duration) {
+                               player.stepExecution = stepExecution;
+                               performMovement(player, step.movement, duration, step.rotation, false);
+                           }});
+    }
+    for (const char* kernel : {"scalar", "sse2", "avx2"}) {
+        if (!PlayerBatch::useKernel(kernel)) continue;
+        auto move = [kernel](Player& player, const Step& step, int duration) {
+            PlayerBatch::useKernel(kernel);
+            PlayerBatch batch(player, BATCH_SIZE);
+            performMovement(batch, step.movement, duration, step.rotation);
+            batch.store(0, player);
+            Sample first = sample(player, 0);
+            for (size_t lane = 1; lane < batch.size(); lane++) {
+                Player other = player;
+                batch.store(lane, other);
+                Sample sampled = sample(other, 0);
+                if (std::memcmp(&first, &sampled, sizeof(Sample)) != 0) {
+                    throw std::runtime_error("Lane " + std::to_string(lane) + " diverged");
+                }
+            }
+        };
+        engines.push_back({std::string("batch ") + kernel, BATCH_SIZE, move});
+    }
+    return engines;
+}
+
+void perform(Player& player, const Engine& engine, const Step& step, int duration, Snapshots& snapshots) {
+    if (step.builtin.has_value()) {
+        static Recorder recorder;
+        callBuiltin(step.builtin.value(), player, step.args, discard(), recorder, snapshots);
+    } else {
+        engine.move(player, step, duration);
+    }
+}
+
+std::vector<Sample> trace(const std::vector<Step>& steps, const Engine& engine) {
+    std::vector<Sample> samples;
+    Player player;
+    Snapshots snapshots;
+    for (size_t i = 0; i < steps.size(); i++) {
+        for (int ticks = 1; !steps[i].builtin.has_value() && ticks <= steps[i].duration; ticks++) {
+            Player ahead = player;
+            perform(ahead, engine, steps[i], ticks, snapshots);
+            samples.push_back(sample(ahead, i));
+        }
+        perform(player, engine, steps[i], steps[i].duration, snapshots);
+    }
+    return samples;
+}
+
+// Nanoseconds a tick of one player takes when the script runs untraced, over at least a tenth of a second.
+double timeTick(const std::vector<Step>& steps, const Engine& engine) {
+    using Clock = std::chrono::steady_clock;
+    int64_t ticks = 0;
+    Clock::time_point start = Clock::now(), now = start;
+    while (now - start < std::chrono::milliseconds(100)) {
+        Player player;
+        Snapshots snapshots;
+        for (const Step& step : steps) {
+            perform(player, engine, step, step.duration, snapshots);
+            if (!step.builtin.has_value()) ticks += std::max(step.duration, 0);
+        }
+        now = Clock::now();
+    }
+    return std::chrono::duration<double, std::nano>(now - start).count() / std::max<int64_t>(ticks * engine.lanes, 1);
+}
+
+void write(const std::string& path, const std::vector<Sample>& samples) {
+    std::ofstream file(path, std::ios::binary);
+    uint32_t count = samples.size();
+    file.write(MAGIC, sizeof(MAGIC));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(Sample));
+    if (!file) throw std::runtime_error("Error while writing " + path);
+}
+
+std::vector<Sample> read(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    uint32_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) throw std::runtime_error(path + " is not a trace");
+    std::vector<Sample> samples(count);
+    file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(Sample));
+    if (!file) throw std::runtime_error(path + " is truncated");
+    return samples;
+}
+
+// Prints where `actual` first differs from `expected`, false when they are the same bit for bit.
+bool differs(const std::vector<Sample>& expected, const std::vector<Sample>& actual) {
+    for (size_t i = 0; i < std::max(expected.size(), actual.size()); i++) {
+        if (i < expected.size() && i < actual.size() && std::memcmp(&expected[i], &actual[i], sizeof(Sample)) == 0)
+            continue;
+        if (i >= expected.size() || i >= actual.size()) {
+            std::printf("  %zu ticks instead of %zu\n", actual.size(), expected.size());
+            return true;
+        }
+        const Sample &e = expected[i], &a = actual[i];
+        std::printf("  tick %zu of call %u\n", i, e.step);
+        std::printf("    expected x %.17g z %.17g vx %.17g vz %.17g facing %.9g state %u keys %u\n", e.x, e.z, e.vx,
+                    e.vz, e.rotation, e.state, e.keys);
+        std::printf("    got      x %.17g z %.17g vx %.17g vz %.17g facing %.9g state %u keys %u\n", a.x, a.z, a.vx,
+                    a.vz, a.rotation, a.state, a.keys);
+        return true;
+    }
+    return false;
+}
+
+// Checks every engine against `expected`, or the reference when there is none. False if any diverges.
+bool check(const std::string& name, const std::vector<Step>& steps, std::optional<std::vector<Sample>> expected) {
+    bool ok = true;
+    for (const Engine& engine : engines()) {
+        std::vector<Sample> actual;
+        std::string error;
+        try {
+            actual = trace(steps, engine);
+        } catch (std::exception& e) {
+            error = e.what();
+        }
+        if (!expected.has_value() && error.empty()) expected = actual;
+        bool failed = !error.empty() || differs(expected.value(), actual);
+        std::printf("%-12s %-14s %6zu ticks  %-8s %8.2f ns/tick%s%s\n", name.c_str(), engine.name.c_str(),
+                    actual.size(), failed ? "DIFFERS" : "ok", timeTick(steps, engine), error.empty() ? "" : "  ",
+                    error.c_str());
+        ok = ok && !failed;
+    }
+    return ok;
+}
+
+// Runs a script on the tree-walker, on the VM, and on the VM again with every optimize trying all candidates instead
+// of searching them as a tree. False if they print something else, fail elsewhere or leave the player elsewhere.
+bool compare(const std::string& name, const std::string& source) {
+    const char* const runners[] = {"tree-walker", "VM", "VM without search"};
+    auto run = [&source](size_t runner, Player& player) {
+        Scanner scanner(source);
+        Script script = scanner.scan();
+        Optimizer(*script.arena).optimize(script);
+        std::unique_ptr<Output> output = Output::create(Output::Format::Text, -1);
+        std::ostringstream errors;
+        if (runner == 0) {
+            CodeVisitor visitor(*output, errors);
+            script.root->accept(visitor);
+            player = visitor.player();
+        } else {
+            Program program = Compiler().compile(script);
+            if (runner == 2) {
+                for (Chunk& chunk : program.chunks) chunk.search = std::nullopt;
+            }
+            VM vm(std::move(program), *output, errors);
+            vm.run();
+            player = vm.player();
+        }
+        return output->take() + errors.str();
+    };
+    std::string written[std::size(runners)];
+    Sample samples[std::size(runners)];
+    for (size_t i = 0; i < std::size(runners); i++) {
+        Player player;
+        written[i] = run(i, player);
+        samples[i] = sample(player, 0);
+    }
+    bool ok = true;
+    for (size_t i = 1; i < std::size(runners); i++) {
+        bool same = written[i] == written[0] && std::memcmp(&samples[i], &samples[0], sizeof(Sample)) == 0;
+        std::printf("%-12s %-17s %3s        %s\n", name.c_str(), runners[i], "", same ? "ok" : "DIFFERS");
+        if (written[i] != written[0]) {
+            std::printf("  %s wrote\n%s  %s wrote\n%s", runners[0], written[0].c_str(), runners[i], written[i].c_str());
+        } else if (!same) {
+            differs({samples[0]}, {samples[i]});
+        }
+        ok = ok && same;
+    }
+    return ok;
+}
+
+std::vector<Step> loadFile(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) throw std::runtime_error(std::string("Can't open ") + path);
+    Scanner scanner(fd);
+    std::vector<Step> steps = load(scanner);
+    close(fd);
+    return steps;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        std::string_view mode = argc > 1 ? argv[1] : "";
+        if (mode == "record" && argc == 4) {
+            write(argv[3], trace(loadFile(argv[2]), engines().front()));
+            return 0;
+        }
+        if (mode == "check" && (argc == 3 || argc == 4)) {
+            std::optional<std::vector<Sample>> expected;
+            if (argc == 4) expected = read(argv[3]);
+            return check(argv[2], loadFile(argv[2]), expected) ? 0 : 1;
+        }
+        if (mode == "compare" && argc == 3) {
+            std::ifstream file(argv[2]);
+            if (!file) throw std::runtime_error(std::string("Can't open ") + argv[2]);
+            std::stringstream source;
+            source << file.rdbuf();
+            return compare(argv[2], source.str()) ? 0 : 1;
+        }
+        if (argc == 1) {
+            bool ok = true;
+            for (size_t i = 0; i < std::size(CORPUS); i++) {
+                std::string source = CORPUS[i];
+                Scanner scanner(source);
+                ok = check("corpus " + std::to_string(i), load(scanner), std::nullopt) && ok;
+            }
+            for (size_t i = 0; i < std::size(SCRIPTS); i++) {
+                ok = compare("script " + std::to_string(i), SCRIPTS[i]) && ok;
+            }
+            return ok ? 0 : 1;
+        }
+        std::fprintf(stderr, "usage: %s [record script golden | check script [golden] | compare script]\n", argv[0]);
+        return 2;
+    } catch (std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -4,8 +4,8 @@ template <typename T>
 struct Vector2 {
     T x;
     T z;
-    Vector2() : x{}, z{} {}
-    Vector2(T x, T z) : x(x), z(z) {}
+    constexpr Vector2() : x{}, z{} {}
+    constexpr Vector2(T x, T z) : x(x), z(z) {}
     void add(const Vector2 &other) {
         x += other.x;
         z += other.z;
@@ -0,0 +1,598 @@
+#include "vm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+
+#include "threadpool.h"
+
+using Tag = VMValue::Tag;
+
+// Values that never were assigned or came from a function call fail the way the tree-walker's lookups do.
+static void checkValue(const VMValue& value) {
+    if (value.tag == Tag::Unset) throw std::runtime_error("Variable not recognized");
+    if (value.tag == Tag::None) throw std::bad_optional_access();
+}
+
+static void checkArguments(const VMValue* first, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (first[i].tag == Tag::Unset) throw std::runtime_error("Variable not recognized");
+        if (first[i].tag == Tag::None) throw std::runtime_error("Error invalid argument");
+    }
+}
+
+[[noreturn]] static void operandError(const VMValue& lhs, const VMValue& rhs, const char* message) {
+    checkValue(rhs);
+    checkValue(lhs);
+    throw std::runtime_error(message);
+}
+
+[[noreturn]] static void operandError(const VMValue& operand, const char* message) {
+    checkValue(operand);
+    throw std::runtime_error(message);
+}
+
+template <typename T>
+static T checkRhs(T rhs) {
+    if (rhs == 0) {
+        throw std::runtime_error("Can not divide by zero");
+    }
+    return rhs;
+}
+
+template <typename Op>
+static VMValue arithmetic(const VMValue& lhs, const VMValue& rhs, Op op) {
+    if (lhs.tag == Tag::Integer && rhs.tag == Tag::Integer) return VMValue::integer(op(lhs.i, rhs.i));
+    if (lhs.tag == Tag::Float && rhs.tag == Tag::Float) return VMValue::floating(op(lhs.f, rhs.f));
+    if (lhs.tag == Tag::Integer && rhs.tag == Tag::Float) return VMValue::floating(op(lhs.i, rhs.f));
+    if (lhs.tag == Tag::Float && rhs.tag == Tag::Integer) return VMValue::floating(op(lhs.f, rhs.i));
+    // Every arithmetic operator has reported itself as add since the tree-walker.
+    operandError(lhs, rhs, "Invalid operands for add");
+}
+
+template <typename Op>
+static VMValue compare(const VMValue& lhs, const VMValue& rhs, Op op, const char* message) {
+    if (lhs.tag == Tag::Integer && rhs.tag == Tag::Integer) return VMValue::boolean(op(lhs.i, rhs.i));
+    if (lhs.tag == Tag::Float && rhs.tag == Tag::Float) return VMValue::boolean(op(lhs.f, rhs.f));
+    if (lhs.tag == Tag::Integer && rhs.tag == Tag::Float) return VMValue::boolean(op(lhs.i, rhs.f));
+    if (lhs.tag == Tag::Float && rhs.tag == Tag::Integer) return VMValue::boolean(op(lhs.f, rhs.i));
+    operandError(lhs, rhs, message);
+}
+
+static bool equals(const VMValue& lhs, const VMValue& rhs, const char* message) {
+    if (lhs.tag == Tag::Boolean && rhs.tag == Tag::Boolean) return lhs.b == rhs.b;
+    if (lhs.tag == Tag::String && rhs.tag == Tag::String) return lhs.s == rhs.s;
+    return compare(lhs, rhs, [](auto l, auto r) { return l == r; }, message).b;
+}
+
+static VMValue logical(const VMValue& lhs, const VMValue& rhs, bool isAnd) {
+    if (lhs.tag != Tag::Boolean || rhs.tag != Tag::Boolean) {
+        operandError(lhs, rhs, isAnd ? "Invalid operands for and" : "Invalid operands for or");
+    }
+    return VMValue::boolean(isAnd ? lhs.b && rhs.b : lhs.b || rhs.b);
+}
+
+static float toFloat(const VMValue& value) {
+    switch (value.tag) {
+        case Tag::Integer:
+            return static_cast<float>(value.i);
+        case Tag::Float:
+            return value.f;
+        case Tag::Boolean:
+            throw std::runtime_error("Expected float got bool instead");
+        default:
+            throw std::runtime_error("Expected float got string instead");
+    }
+}
+
+static double& field(Player& player, uint32_t field) {
+    switch (static_cast<Field>(field)) {
+        case Field::X:
+            return player.position.x;
+        case Field::Z:
+            return player.position.z;
+        case Field::VX:
+            return player.velocity.x;
+        default:
+            return player.velocity.z;
+    }
+}
+
+Value VM::toValue(const VMValue& value) const {
+    switch (value.tag) {
+        case Tag::Integer:
+            return value.i;
+        case Tag::Float:
+            return value.f;
+        case Tag::Boolean:
+            return value.b;
+        default:
+            if (value.s >= m_program->strings.size()) return m_strings[value.s - m_program->strings.size()];
+            return m_program->strings[value.s];
+    }
+}
+
+static VMValue fromValue(const Value& value) {
+    if (const int* i = std::get_if<int>(&value)) return VMValue::integer(*i);
+    return VMValue::floating(std::get<float>(value));
+}
+
+std::vector<Value> VM::arguments(const VMValue* first, uint32_t count) const {
+    checkArguments(first, count);
+    std::vector<Value> args;
+    args.reserve(count);
+    for (uint32_t i = 0; i < count; i++) args.push_back(toValue(first[i]));
+    return args;
+}
+
+// Finds the statement the error happened in and continues after it, unwinding calls that have no handler.
+bool VM::recover(std::exception& e, const Instruction*& ip) {
+    for (;;) {
+        const Chunk& chunk = m_program->chunks[m_frames.back().chunk];
+        uint32_t pc = ip - 1 - chunk.code.data();
+        for (auto& handler : chunk.handlers) {
+            if (handler.start <= pc && pc < handler.end) {
+                if (!m_quiet) {
+                    m_output->flush();
+                    *m_errors << "\033[31m" << "ERROR: " << e.what() << "\033[0m" << std::endl;
+                }
+                ip = chunk.code.data() + handler.end;
+                return true;
+            }
+        }
+        if (m_frames.size() == m_baseDepth + 1) return false;
+        ip = m_frames.back().ret;
+        m_frames.pop_back();
+    }
+}
+
+void VM::define(uint32_t slot, const Value& value) {
+    if (slot >= m_inputs.size()) m_inputs.resize(slot + 1);
+    if (const std::string* text = std::get_if<std::string>(&value)) {
+        // Strings compare by index, one that a literal spells must get the index of the literal.
+        const std::vector<std::string>& strings = m_program->strings;
+        auto it = std::find(strings.begin(), strings.end(), *text);
+        if (it == strings.end()) {
+            auto own = std::find(m_strings.begin(), m_strings.end(), *text);
+            if (own == m_strings.end()) own = m_strings.insert(own, *text);
+            m_inputs[slot] = VMValue::string(strings.size() + (own - m_strings.begin()));
+        } else {
+            m_inputs[slot] = VMValue::string(it - strings.begin());
+        }
+    } else if (const bool* boolean = std::get_if<bool>(&value)) {
+        m_inputs[slot] = VMValue::boolean(*boolean);
+    } else {
+        m_inputs[slot] = fromValue(value);
+    }
+}
+
+void VM::run() {
+    const Chunk& main = m_program->chunks[0];
+    m_registers.assign(main.numRegisters, VMValue{});
+    m_frames.clear();
+    m_declared.clear();
+    m_baseDepth = 0;
+    m_frames.push_back(Frame{0, 0, nullptr, false});
+    const Instruction* ip = main.code.data();
+    for (;;) {
+        try {
+            execute(ip);
+            return;
+        } catch (std::exception& e) {
+            if (!recover(e, ip)) throw;
+        }
+    }
+}
+
+// Pushes a frame for `chunk` whose first `arguments` registers at `base` are already filled in.
+void VM::call(uint32_t chunk, size_t base, uint32_t arguments, const Instruction* ret, bool tap) {
+    const Chunk& callee = m_program->chunks[chunk];
+    if (m_registers.size() < base + callee.numRegisters) m_registers.resize(base + callee.numRegisters);
+    std::fill(m_registers.begin() + base + arguments, m_registers.begin() + base + callee.numRegisters, VMValue{});
+    m_frames.push_back(Frame{chunk, base, ret, tap});
+}
+
+// Runs one optimize candidate to completion on this VM and scores it, nothing if it failed or doesn't count.
+std::optional<double> VM::evaluate(const Instruction& in, size_t base, const std::vector<Value>& values) {
+    TapMode mode = static_cast<TapMode>(in.mode & 3);
+    bool tap = mode == TapMode::Inherit ? m_frames.back().tap : mode == TapMode::On;
+    call(in.a, base, in.c, nullptr, tap);
+    for (size_t i = 0; i < values.size(); i++) m_registers[base + i] = fromValue(values[i]);
+    const Instruction* ip = m_program->chunks[in.a].code.data();
+    for (;;) {
+        try {
+            execute(ip);
+            break;
+        } catch (std::exception& e) {
+            if (!recover(e, ip)) return std::nullopt;
+        }
+    }
+
+    // The candidate chunk leaves its objective in the register after the parameters.
+    const VMValue& objective = m_registers[base + in.c];
+    if (objective.tag != Tag::Integer && objective.tag != Tag::Float && objective.tag != Tag::Boolean) {
+        return std::nullopt;
+    }
+    return scoreObjective(static_cast<OptimizeStmt::Goal>(in.mode >> 2), toValue(objective));
+}
+
+// Evaluates every candidate on a private copy of this VM, one per pool worker, and returns the best one. The lowest
+// index wins ties, so the result doesn't depend on how the candidates were scheduled.
+std::optional<size_t> VM::optimize(const Instruction& in, size_t base, const std::vector<SearchRange>& ranges) {
+    size_t count = countCandidates(ranges);
+    bool until = static_cast<OptimizeStmt::Goal>(in.mode >> 2) == OptimizeStmt::Goal::Until;
+    TapMode mode = static_cast<TapMode>(in.mode & 3);
+    bool tap = mode == TapMode::Inherit ? m_frames.back().tap : mode == TapMode::On;
+    if (const std::optional<SearchPlan>& plan = m_program->chunks[in.a].search; plan.has_value() && !tap) {
+        return search(plan.value(), m_player, ranges, !m_quiet);
+    }
+
+    VM prototype = *this;
+    prototype.m_quiet = true;
+    prototype.m_player.recorder = nullptr;
+    prototype.m_baseDepth = m_frames.size();
+    auto run = [&prototype, &in, base, &ranges](VM& worker, size_t index) {
+        worker.m_player = prototype.m_player;
+        worker.m_snapshots = prototype.m_snapshots;
+        worker.m_registers = prototype.m_registers;
+        worker.m_declared = prototype.m_declared;
+        worker.m_inputs = prototype.m_inputs;
+        worker.m_frames.resize(prototype.m_frames.size());
+        return worker.evaluate(in, base, candidateValues(ranges, index));
+    };
+
+    BestCandidate best;
+    if (m_quiet) {
+        // Already inside a worker and the pool is busy, nested searches run serially.
+        VM worker = prototype;
+        for (size_t index = 0; index < count; index++) {
+            if (std::optional<double> score = run(worker, index)) {
+                best.offer(index, score.value());
+                if (until) break;
+            }
+        }
+        return best.index;
+    }
+
+    ThreadPool& pool = ThreadPool::shared();
+    std::vector<VM> workers(pool.size(), prototype);
+    std::vector<BestCandidate> bests(pool.size());
+    // With Goal::Until only candidates before the first one found so far can still matter.
+    std::atomic<size_t> found = count;
+    pool.parallelFor(count, [&](size_t worker, size_t index) {
+        if (until && index > found.load(std::memory_order_relaxed)) return;
+        std::optional<double> score = run(workers[worker], index);
+        if (!score.has_value()) return;
+        bests[worker].offer(index, score.value());
+        size_t current = found.load(std::memory_order_relaxed);
+        while (until && index < current && !found.compare_exchange_weak(current, index, std::memory_order_relaxed)) {
+        }
+    });
+    for (auto& it : bests) {
+        if (it.index.has_value()) best.offer(it.index.value(), it.score);
+    }
+    return best.index;
+}
+
+void VM::execute(const Instruction*& ip) {
+    Frame* frame = &m_frames.back();
+    VMValue* regs = m_registers.data() + frame->base;
+    const Instruction* code = m_program->chunks[frame->chunk].code.data();
+    auto rk = [&](uint32_t operand) -> const VMValue& {
+        return operand & Instruction::CONSTANT ? constant(operand) : regs[operand];
+    };
+
+    for (;;) {
+        const Instruction& in = *ip++;
+        switch (in.op) {
+            case OpCode::LoadK:
+                regs[in.a] = constant(in.b);
+                break;
+            case OpCode::LoadNone:
+                regs[in.a] = VMValue::none();
+                break;
+            case OpCode::Move:
+                if (regs[in.b].tag == Tag::Unset) checkValue(regs[in.b]);
+                regs[in.a] = regs[in.b];
+                break;
+            case OpCode::Check:
+                checkValue(regs[in.a]);
+                break;
+            case OpCode::GetGlobal:
+                if (m_registers[in.b].tag == Tag::Unset) checkValue(m_registers[in.b]);
+                regs[in.a] = m_registers[in.b];
+                break;
+            case OpCode::SetGlobal:
+                m_registers[in.a] = rk(in.b);
+                break;
+            case OpCode::GetInput:
+                if (in.b >= m_inputs.size() || m_inputs[in.b].tag == Tag::Unset) {
+                    throw std::runtime_error("Variable not recognized");
+                }
+                regs[in.a] = m_inputs[in.b];
+                break;
+            case OpCode::SetInput:
+                m_inputs[in.a] = rk(in.b);
+                break;
+            case OpCode::CheckInput:
+                if (in.a >= m_inputs.size() || m_inputs[in.a].tag == Tag::Unset) {
+                    throw std::runtime_error("Undefined variable");
+                }
+                break;
+            case OpCode::GetUp: {
+                const VMValue& value = m_registers[m_frames[m_frames.size() - 1 - in.c].base + in.b];
+                if (value.tag == Tag::Unset) checkValue(value);
+                regs[in.a] = value;
+                break;
+            }
+            case OpCode::SetUp:
+                m_registers[m_frames[m_frames.size() - 1 - in.c].base + in.a] = rk(in.b);
+                break;
+            case OpCode::GetField:
+                regs[in.a] = VMValue::floating(static_cast<float>(field(m_player, in.b)));
+                break;
+            case OpCode::SetField: {
+                const VMValue& value = rk(in.b);
+                float assigned;
+                if (value.tag == Tag::Integer) {
+                    assigned = static_cast<float>(value.i);
+                } else if (value.tag == Tag::Float) {
+                    assigned = value.f;
+                } else {
+                    operandError(value, "Invalid value for variable");
+                }
+                field(m_player, in.a) = assigned;
+                regs[in.c] = VMValue::floating(assigned);
+                break;
+            }
+            case OpCode::Neg: {
+                const VMValue& value = rk(in.b);
+                if (value.tag == Tag::Integer) {
+                    regs[in.a] = VMValue::integer(-value.i);
+                } else if (value.tag == Tag::Float) {
+                    regs[in.a] = VMValue::floating(-value.f);
+                } else {
+                    operandError(value, "Invalid operands for unary minus");
+                }
+                break;
+            }
+            case OpCode::Plus: {
+                const VMValue& value = rk(in.b);
+                if (value.tag != Tag::Integer && value.tag != Tag::Float) {
+                    operandError(value, "Invalid operands for unary plus");
+                }
+                regs[in.a] = value;
+                break;
+            }
+            case OpCode::Add:
+                regs[in.a] = arithmetic(rk(in.b), rk(in.c), [](auto l, auto r) { return l + r; });
+                break;
+            case OpCode::Sub:
+                regs[in.a] = arithmetic(rk(in.b), rk(in.c), [](auto l, auto r) { return l - r; });
+                break;
+            case OpCode::Mul:
+                regs[in.a] = arithmetic(rk(in.b), rk(in.c), [](auto l, auto r) { return l * r; });
+                break;
+            case OpCode::Div:
+                regs[in.a] = arithmetic(rk(in.b), rk(in.c), [](auto l, auto r) { return l / checkRhs(r); });
+                break;
+            case OpCode::Lt:
+                regs[in.a] = compare(rk(in.b), rk(in.c), [](auto l, auto r) { return l < r; },
+                                     "Invalid operands for less than");
+                break;
+            case OpCode::Gt:
+                regs[in.a] = compare(rk(in.b), rk(in.c), [](auto l, auto r) { return l > r; },
+                                     "Invalid operands for greater than");
+                break;
+            case OpCode::Le:
+                regs[in.a] = compare(rk(in.b), rk(in.c), [](auto l, auto r) { return l <= r; },
+                                     "Invalid operands for less than or equals");
+                break;
+            case OpCode::Ge:
+                regs[in.a] = compare(rk(in.b), rk(in.c), [](auto l, auto r) { return l >= r; },
+                                     "Invalid operands for greater than or equals");
+                break;
+            case OpCode::Eq:
+                regs[in.a] = VMValue::boolean(equals(rk(in.b), rk(in.c), "Invalid operands for equals"));
+                break;
+            case OpCode::Ne:
+                regs[in.a] = VMValue::boolean(!equals(rk(in.b), rk(in.c), "Invalid operands for not equals"));
+                break;
+            case OpCode::And:
+                regs[in.a] = logical(rk(in.b), rk(in.c), true);
+                break;
+            case OpCode::Or:
+                regs[in.a] = logical(rk(in.b), rk(in.c), false);
+                break;
+            case OpCode::AddII:
+                regs[in.a] = VMValue::integer(rk(in.b).i + rk(in.c).i);
+                break;
+            case OpCode::SubII:
+                regs[in.a] = VMValue::integer(rk(in.b).i - rk(in.c).i);
+                break;
+            case OpCode::MulII:
+                regs[in.a] = VMValue::integer(rk(in.b).i * rk(in.c).i);
+                break;
+            case OpCode::DivII:
+                regs[in.a] = VMValue::integer(rk(in.b).i / checkRhs(rk(in.c).i));
+                break;
+            case OpCode::LtII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i < rk(in.c).i);
+                break;
+            case OpCode::GtII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i > rk(in.c).i);
+                break;
+            case OpCode::LeII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i <= rk(in.c).i);
+                break;
+            case OpCode::GeII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i >= rk(in.c).i);
+                break;
+            case OpCode::EqII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i == rk(in.c).i);
+                break;
+            case OpCode::NeII:
+                regs[in.a] = VMValue::boolean(rk(in.b).i != rk(in.c).i);
+                break;
+            case OpCode::AddFF:
+                regs[in.a] = VMValue::floating(rk(in.b).f + rk(in.c).f);
+                break;
+            case OpCode::SubFF:
+                regs[in.a] = VMValue::floating(rk(in.b).f - rk(in.c).f);
+                break;
+            case OpCode::MulFF:
+                regs[in.a] = VMValue::floating(rk(in.b).f * rk(in.c).f);
+                break;
+            case OpCode::DivFF:
+                regs[in.a] = VMValue::floating(rk(in.b).f / checkRhs(rk(in.c).f));
+                break;
+            case OpCode::LtFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f < rk(in.c).f);
+                break;
+            case OpCode::GtFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f > rk(in.c).f);
+                break;
+            case OpCode::LeFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f <= rk(in.c).f);
+                break;
+            case OpCode::GeFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f >= rk(in.c).f);
+                break;
+            case OpCode::EqFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f == rk(in.c).f);
+                break;
+            case OpCode::NeFF:
+                regs[in.a] = VMValue::boolean(rk(in.b).f != rk(in.c).f);
+                break;
+            case OpCode::Jump:
+                ip = code + in.b;
+                break;
+            case OpCode::JumpIfNot: {
+                const VMValue& condition = regs[in.a];
+                if (condition.tag != Tag::Boolean) {
+                    operandError(condition, in.mode == 0 ? "Invalid condition for if statement"
+                                                         : "Invalid condition for while statement");
+                }
+                if (!condition.b) ip = code + in.b;
+                break;
+            }
+            case OpCode::JumpIfSet: {
+                const VMValue& value = in.mode == 0   ? regs[in.a]
+                                       : in.mode == 1 ? m_registers[in.a]
+                                                      : m_registers[m_frames[m_frames.size() - 1 - in.c].base + in.a];
+                if (value.tag != Tag::Unset) ip = code + in.b;
+                break;
+            }
+            case OpCode::ForPrep: {
+                VMValue& counter = regs[in.a];
+                if (counter.tag == Tag::Float) {
+                    counter = VMValue::integer(static_cast<int>(counter.f));
+                } else if (counter.tag != Tag::Integer) {
+                    operandError(counter, "Invalid expression for loop");
+                }
+                if (counter.i <= 0) ip = code + in.b;
+                break;
+            }
+            case OpCode::ForLoop:
+                if (--regs[in.a].i > 0) ip = code + in.b;
+                break;
+            case OpCode::Call: {
+                for (uint32_t i = 0; i < in.c; i++) checkValue(regs[in.b + i]);
+                TapMode mode = static_cast<TapMode>(in.mode);
+                bool tap = mode == TapMode::Inherit ? frame->tap : mode == TapMode::On;
+                call(in.a, frame->base + in.b, in.c, ip, tap);
+                frame = &m_frames.back();
+                regs = m_registers.data() + frame->base;
+                code = m_program->chunks[in.a].code.data();
+                ip = code;
+                break;
+            }
+            case OpCode::Return: {
+                if (m_frames.size() == m_baseDepth + 1) return;
+                ip = frame->ret;
+                m_frames.pop_back();
+                frame = &m_frames.back();
+                regs = m_registers.data() + frame->base;
+                code = m_program->chunks[frame->chunk].code.data();
+                break;
+            }
+            case OpCode::Declare:
+                if (in.a >= m_declared.size()) m_declared.resize(in.a + 1);
+                if (m_declared[in.a] == 0) m_declared[in.a] = in.b;
+                break;
+            case OpCode::Dispatch:
+                if (in.a < m_declared.size()) ip += m_declared[in.a];
+                break;
+            case OpCode::Movement: {
+                const VMValue* args = regs + in.b;
+                checkArguments(args, in.c);
+                int duration = 1;
+                std::optional<float> rotation = std::nullopt;
+                if (in.c > 0) {
+                    if (args[0].tag == Tag::Integer) {
+                        duration = args[0].i;
+                    } else if (args[0].tag == Tag::Float) {
+                        duration = static_cast<int>(args[0].f);
+                    } else {
+                        throw std::runtime_error(args[0].tag == Tag::Boolean ? "Expected int got bool instead"
+                                                                             : "Expected int got string instead");
+                    }
+                }
+                if (in.c > 1) {
+                    if (args[1].tag == Tag::Integer) {
+                        rotation = static_cast<float>(args[1].i);
+                    } else if (args[1].tag == Tag::Float) {
+                        rotation = args[1].f;
+                    } else {
+                        throw std::runtime_error(args[1].tag == Tag::Boolean ? "Expected int got bool instead"
+                                                                             : "Expected int got string instead");
+                    }
+                }
+                TapMode mode = static_cast<TapMode>(in.mode);
+                bool tap = mode == TapMode::Inherit ? frame->tap : mode == TapMode::On;
+                performMovement(m_player, m_program->movements[in.a], duration, rotation, tap);
+                break;
+            }
+            case OpCode::Facing:
+                checkArguments(regs + in.b, in.c);
+                m_player.face(in.c > 0 ? toFloat(regs[in.b]) : 0.0f);
+                break;
+            case OpCode::SetPosition:
+                checkArguments(regs + in.b, in.c);
+                field(m_player, in.a) = in.c > 0 ? toFloat(regs[in.b]) : 0.0f;
+                break;
+            case OpCode::Builtin:
+                if (m_quiet && isOutputBuiltin(static_cast<Builtin>(in.a))) break;
+                callBuiltin(static_cast<Builtin>(in.a), m_player, arguments(regs + in.b, in.c), *m_output,
+                            *m_recorder, m_snapshots);
+                break;
+            case OpCode::Optimize: {
+                checkArguments(regs + in.b, in.c * 3);
+                std::vector<SearchRange> ranges;
+                for (uint32_t i = 0; i < in.c; i++) {
+                    const VMValue* range = regs + in.b + 3 * i;
+                    ranges.push_back(makeSearchRange(toValue(range[0]), toValue(range[1]), toValue(range[2])));
+                }
+                size_t base = frame->base + in.b + 3 * in.c;
+                std::optional<size_t> best = optimize(in, base, ranges);
+                if (!best.has_value()) throw std::runtime_error("No candidate found for optimize");
+
+                // The winner runs once more for real, output and all.
+                TapMode mode = static_cast<TapMode>(in.mode & 3);
+                bool tap = mode == TapMode::Inherit ? frame->tap : mode == TapMode::On;
+                call(in.a, base, in.c, ip, tap);
+                std::vector<Value> values = candidateValues(ranges, best.value());
+                for (size_t i = 0; i < values.size(); i++) m_registers[base + i] = fromValue(values[i]);
+                frame = &m_frames.back();
+                regs = m_registers.data() + base;
+                code = m_program->chunks[in.a].code.data();
+                ip = code;
+                break;
+            }
+            case OpCode::Throw:
+                throw std::runtime_error(m_program->strings[in.a]);
+        }
+    }
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "builtins.h"
+#include "output.h"
+#include "player.h"
+#include "recorder.h"
+#include "search.h"
+
+// A register. Strings only ever come from literals, so they are an index into Program::strings.
+struct VMValue {
+    enum class Tag : uint8_t { Unset, None, Integer, Float, Boolean, String };
+    Tag tag = Tag::Unset;
+    union {
+        int i;
+        float f;
+        bool b;
+        uint32_t s;
+    };
+    VMValue() : i(0) {}
+    static VMValue none() {
+        VMValue value;
+        value.tag = Tag::None;
+        return value;
+    }
+    static VMValue integer(int i) {
+        VMValue value;
+        value.tag = Tag::Integer;
+        value.i = i;
+        return value;
+    }
+    static VMValue floating(float f) {
+        VMValue value;
+        value.tag = Tag::Float;
+        value.f = f;
+        return value;
+    }
+    static VMValue boolean(bool b) {
+        VMValue value;
+        value.tag = Tag::Boolean;
+        value.b = b;
+        return value;
+    }
+    static VMValue string(uint32_t s) {
+        VMValue value;
+        value.tag = Tag::String;
+        value.s = s;
+        return value;
+    }
+};
+
+// Operands named rk may refer to a constant instead of a register when the CONSTANT bit is set.
+enum class OpCode : uint8_t {
+    LoadK,      // R[a] = K[b]
+    LoadNone,   // R[a] = none
+    Move,       // R[a] = R[b]
+    Check,      // throw unless R[a] holds a value
+    GetGlobal,  // R[a] = G[b]
+    SetGlobal,  // G[a] = rk[b]
+    GetInput,   // R[a] = variable b, as given to define()
+    SetInput,   // variable a = rk[b]
+    CheckInput, // throw unless variable a is defined, before it is assigned
+    GetUp,      // R[a] = c frames down [b]
+    SetUp,      // c frames down [a] = rk[b]
+    GetField,   // R[a] = player field b
+    SetField,   // player field a = rk[b], R[c] = assigned value
+    Neg,        // R[a] = -rk[b]
+    Plus,       // R[a] = +rk[b]
+    Add,        // R[a] = rk[b] op rk[c], for every binary operator
+    Sub,
+    Mul,
+    Div,
+    Lt,
+    Gt,
+    Le,
+    Ge,
+    Eq,
+    Ne,
+    And,
+    Or,
+    AddII,  // typed variants, operand types are known at compile time
+    SubII,
+    MulII,
+    DivII,
+    LtII,
+    GtII,
+    LeII,
+    GeII,
+    EqII,
+    NeII,
+    AddFF,
+    SubFF,
+    MulFF,
+    DivFF,
+    LtFF,
+    GtFF,
+    LeFF,
+    GeFF,
+    EqFF,
+    NeFF,
+    Jump,       // pc = b
+    JumpIfNot,  // if !R[a] pc = b, mode tells if or while apart for errors
+    JumpIfSet,  // if variable a is set pc = b, R[a] with mode 0, G[a] with 1, c frames down [a] with 2
+    ForPrep,    // R[a] = loop count, if R[a] <= 0 pc = b
+    ForLoop,    // if --R[a] > 0 pc = b
+    Call,       // call chunk a with c arguments starting at R[b]
+    Return,
+    Declare,    // install declaration b of function a unless one already is
+    Dispatch,   // skip as many instructions as the number of the declaration installed for function a
+    Movement,   // perform movement a with c arguments starting at R[b]
+    Facing,     // face c arguments starting at R[b]
+    SetPosition,  // set player field a from c arguments starting at R[b]
+    Builtin,      // call builtin a with c arguments starting at R[b]
+    Optimize,     // search chunk a over c ranges starting at R[b], mode holds tap and goal
+    Throw,        // throw Program::strings[a]
+};
+
+enum class TapMode : uint8_t { Off, On, Inherit };
+struct Instruction {
+    static constexpr uint32_t CONSTANT = 1u << 31;
+    OpCode op;
+    uint8_t mode = 0;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+struct Chunk {
+    // Every statement of a block is guarded, an error skips to the end of the innermost one.
+    struct Handler {
+        uint32_t start;
+        uint32_t end;
+    };
+    std::string name;
+    std::vector<Instruction> code;
+    std::vector<Handler> handlers;
+    uint32_t numRegisters = 0;
+    // Optimize chunks that can be searched without running them, when not tapping.
+    std::optional<SearchPlan> search;
+};
+
+struct Program {
+    std::vector<Chunk> chunks;  // chunks[0] is the script itself
+    std::vector<VMValue> constants;
+    std::vector<std::string> strings;
+    std::vector<Movement> movements;
+};
+
+class VM {
+   private:
+    struct Frame {
+        uint32_t chunk;
+        size_t base;
+        const Instruction* ret;
+        bool tap;
+    };
+    std::shared_ptr<const Program> m_program;
+    Player m_player;
+    Output* m_output;
+    // Where failed statements are reported.
+    std::ostream* m_errors;
+    // Shared with the copies optimize makes, they never record.
+    std::shared_ptr<Recorder> m_recorder = std::make_shared<Recorder>();
+    Snapshots m_snapshots;
+    std::vector<VMValue> m_registers;
+    std::vector<Frame> m_frames;
+    // The variables of define(), by slot.
+    std::vector<VMValue> m_inputs;
+    // Strings of those that no literal of the program spells, numbered after Program::strings.
+    std::vector<std::string> m_strings;
+    // The declaration of every function by slot, counting from 1, or 0 while none has been executed.
+    std::vector<uint32_t> m_declared;
+    // Frames below this one belong to whoever started the current run, optimize workers stop when they return.
+    size_t m_baseDepth = 0;
+    // Optimize workers skip output and swallow errors.
+    bool m_quiet = false;
+
+   private:
+    const VMValue& constant(uint32_t index) const { return m_program->constants[index & ~Instruction::CONSTANT]; }
+    Value toValue(const VMValue& value) const;
+    std::vector<Value> arguments(const VMValue* first, uint32_t count) const;
+    bool recover(std::exception& e, const Instruction*& ip);
+    void execute(const Instruction*& ip);
+    void call(uint32_t chunk, size_t base, uint32_t arguments, const Instruction* ret, bool tap);
+    std::optional<double> evaluate(const Instruction& in, size_t base, const std::vector<Value>& values);
+    std::optional<size_t> optimize(const Instruction& in, size_t base, const std::vector<SearchRange>& ranges);
+
+   public:
+    explicit VM(Program program, Output& output = Output::standard(), std::ostream& errors = std::cerr)
+        : VM(std::make_shared<const Program>(std::move(program)), output, errors) {}
+    // A program never changes, any number of VMs can run one.
+    explicit VM(std::shared_ptr<const Program> program, Output& output = Output::standard(),
+                std::ostream& errors = std::cerr)
+        : m_program(std::move(program)), m_output(&output), m_errors(&errors) {}
+
+    // Binds a variable before run(), as if the script started with a let. See Script::names for the slot.
+    void define(uint32_t slot, const Value& value);
+    void run();
+    Player& player() { return m_player; }
+};